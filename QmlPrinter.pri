@@ -1,10 +1,56 @@
 INCLUDEPATH += $$PWD
 
+QT += concurrent
+
 SOURCES +=  $$PWD/qmlprinter.cpp \
-            $$PWD/styledtext.cpp
+            $$PWD/displaylist.cpp \
+            $$PWD/imagecache.cpp \
+            $$PWD/imagepolicy.cpp \
+            $$PWD/imposition.cpp \
+            $$PWD/itemproperties.cpp \
+            $$PWD/pdfdocument.cpp \
+            $$PWD/pdflinearizer.cpp \
+            $$PWD/pdfmerger.cpp \
+            $$PWD/persistentcache.cpp \
+            $$PWD/printpreview.cpp \
+            $$PWD/rectanglebatch.cpp \
+            $$PWD/shardedprinter.cpp \
+            $$PWD/styledtext.cpp \
+            $$PWD/textdocumentcache.cpp \
+            $$PWD/textlayoutcache.cpp
 
 HEADERS +=  $$PWD/qmlprinter.h \
-            $$PWD/styledtext.h
+            $$PWD/cachecost.h \
+            $$PWD/displaylist.h \
+            $$PWD/imagecache.h \
+            $$PWD/imagepolicy.h \
+            $$PWD/imposition.h \
+            $$PWD/itemproperties.h \
+            $$PWD/pdfdocument.h \
+            $$PWD/pdflinearizer.h \
+            $$PWD/pdfmerger.h \
+            $$PWD/persistentcache.h \
+            $$PWD/printpreview.h \
+            $$PWD/rectanglebatch.h \
+            $$PWD/shardedprinter.h \
+            $$PWD/styledtext.h \
+            $$PWD/textdocumentcache.h \
+            $$PWD/textlayoutcache.h
+
+# Paint items without a dedicated painter from their scene graph nodes instead
+# of grabbing the window. Uses the QtQuick private API.
+qmlprinter_scenegraph {
+    QT += quick-private
+    DEFINES += QMLPRINTER_SCENEGRAPH
+    SOURCES += $$PWD/scenegraphpainter.cpp
+    HEADERS += $$PWD/scenegraphpainter.h
+}
+
+# Builds the raster colour conversion kernels for AVX2 instead of SSE2. The
+# binary then requires a CPU with AVX2.
+qmlprinter_avx2 {
+    QMAKE_CXXFLAGS += -mavx2
+}
 
 OTHER_FILES += \
             $$PWD/LICENSE
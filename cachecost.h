@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CACHECOST_H
+#define CACHECOST_H
+
+#include <QtGlobal>
+
+#include <climits>
+
+// QCache counts costs with an int, which would limit the caches to 2 GB if
+// they were counted in bytes. The caches count them in kilobytes instead and
+// convert with these helpers.
+
+// Cost of an entry of the given size, at least one so that small entries
+// still count
+inline int cacheCost(qint64 bytes)
+{
+    return int(qBound<qint64>(1, bytes / 1024, INT_MAX));
+}
+
+// Maximum cost for a budget in bytes
+inline int maxCacheCost(qint64 bytes)
+{
+    return int(qBound<qint64>(0, bytes / 1024, INT_MAX));
+}
+
+// Bytes of a total cost
+inline qint64 cacheCostBytes(int cost)
+{
+    return qint64(cost) * 1024;
+}
+
+#endif // CACHECOST_H
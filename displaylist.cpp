@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "displaylist.h"
+
+#include <QPixmap>
+
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+QPainterPath deepCopy(const QPainterPath &path)
+{
+    // addPath() copies the elements into a path of its own
+    QPainterPath copy;
+    copy.addPath(path);
+    copy.setFillRule(path.fillRule());
+    return copy;
+}
+
+}
+
+// Records what QPainter hands to the engine. All features are claimed so that
+// QPainter passes primitives untransformed along with the transform, the same
+// way it does for QPicture.
+class DisplayListEngine : public QPaintEngine
+{
+public:
+    explicit DisplayListEngine(bool keepText) : QPaintEngine(AllFeatures), keepText(keepText) { }
+
+    bool begin(QPaintDevice *device)
+    {
+        Q_UNUSED(device)
+        commands.clear();
+        return true;
+    }
+
+    bool end()
+    {
+        return true;
+    }
+
+    Type type() const
+    {
+        return User;
+    }
+
+    void updateState(const QPaintEngineState &state)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::State;
+        command.flags = state.state();
+        if(command.flags & DirtyPen)
+            command.pen = state.pen();
+        if(command.flags & DirtyBrush)
+            command.brush = state.brush();
+        if(command.flags & DirtyBrushOrigin)
+            command.brushOrigin = state.brushOrigin();
+        if(command.flags & DirtyBackground)
+            command.background = state.backgroundBrush();
+        if(command.flags & DirtyBackgroundMode)
+            command.backgroundMode = state.backgroundMode();
+        if(command.flags & DirtyTransform)
+            command.transform = state.transform();
+        if(command.flags & DirtyClipEnabled)
+            command.clipEnabled = state.isClipEnabled();
+        if(command.flags & (DirtyClipRegion | DirtyClipPath))
+            command.clipOperation = state.clipOperation();
+        if(command.flags & DirtyClipRegion)
+            command.clipRegion = state.clipRegion();
+        if(command.flags & DirtyClipPath)
+            command.clipPath = state.clipPath();
+        if(command.flags & DirtyHints)
+            command.hints = state.renderHints();
+        if(command.flags & DirtyCompositionMode)
+            command.compositionMode = state.compositionMode();
+        if(command.flags & DirtyOpacity)
+            command.opacity = state.opacity();
+        commands.append(command);
+    }
+
+    void drawPath(const QPainterPath &path)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Path;
+        command.path = path;
+        commands.append(command);
+    }
+
+    void drawPolygon(const QPointF *points, int count, PolygonDrawMode mode)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Polygon;
+        command.polygon = QPolygonF(QVector<QPointF>(count));
+        std::copy(points, points + count, command.polygon.begin());
+        command.polygonMode = mode;
+        commands.append(command);
+    }
+
+    void drawRects(const QRectF *rects, int count)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Rects;
+        command.rects = QVector<QRectF>(count);
+        std::copy(rects, rects + count, command.rects.begin());
+        commands.append(command);
+    }
+
+    void drawEllipse(const QRectF &rect)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Ellipse;
+        command.rect = rect;
+        commands.append(command);
+    }
+
+    void drawLines(const QLineF *lines, int count)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Lines;
+        command.lines = QVector<QLineF>(count);
+        std::copy(lines, lines + count, command.lines.begin());
+        commands.append(command);
+    }
+
+    void drawPoints(const QPointF *points, int count)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Points;
+        command.polygon = QPolygonF(QVector<QPointF>(count));
+        std::copy(points, points + count, command.polygon.begin());
+        commands.append(command);
+    }
+
+    void drawPixmap(const QRectF &rect, const QPixmap &pixmap, const QRectF &sourceRect)
+    {
+        // Pixmaps can't be used outside the GUI thread, replaying can
+        drawImage(rect, pixmap.toImage(), sourceRect, Qt::AutoColor);
+    }
+
+    void drawImage(const QRectF &rect, const QImage &image, const QRectF &sourceRect, Qt::ImageConversionFlags flags)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Image;
+        command.rect = rect;
+        command.image = image;
+        command.sourceRect = sourceRect;
+        command.imageFlags = flags;
+        commands.append(command);
+    }
+
+    void drawTextItem(const QPointF &position, const QTextItem &textItem)
+    {
+        // The default implementation fills the glyph outlines through
+        // drawPath()
+        if(!keepText) {
+            QPaintEngine::drawTextItem(position, textItem);
+            return;
+        }
+        DisplayList::Command command;
+        command.type = DisplayList::Command::Text;
+        command.offset = position;
+        command.text = textItem.text();
+        command.font = textItem.font();
+        command.textFlags = textItem.renderFlags();
+        commands.append(command);
+    }
+
+    void drawTiledPixmap(const QRectF &rect, const QPixmap &pixmap, const QPointF &offset)
+    {
+        DisplayList::Command command;
+        command.type = DisplayList::Command::TiledImage;
+        command.rect = rect;
+        command.image = pixmap.toImage();
+        command.offset = offset;
+        commands.append(command);
+    }
+
+    QVector<DisplayList::Command> commands;
+    bool keepText;
+};
+
+void DisplayList::replay(QPainter *painter) const
+{
+    painter->save();
+    Base base;
+    base.transform = painter->worldTransform();
+    base.opacity = painter->opacity();
+    base.clipped = painter->hasClipping();
+    if(base.clipped)
+        base.clip = painter->clipPath();
+
+    foreach(const Command &command, commands) {
+        switch(command.type) {
+        case Command::State:
+            replayState(command, painter, base);
+            break;
+        case Command::Path:
+            painter->drawPath(command.path);
+            break;
+        case Command::Polygon:
+            if(command.polygonMode == QPaintEngine::PolylineMode)
+                painter->drawPolyline(command.polygon);
+            else if(command.polygonMode == QPaintEngine::ConvexMode)
+                painter->drawConvexPolygon(command.polygon);
+            else
+                painter->drawPolygon(command.polygon, command.polygonMode == QPaintEngine::WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
+            break;
+        case Command::Rects:
+            painter->drawRects(command.rects);
+            break;
+        case Command::Ellipse:
+            painter->drawEllipse(command.rect);
+            break;
+        case Command::Lines:
+            painter->drawLines(command.lines);
+            break;
+        case Command::Points:
+            painter->drawPoints(command.polygon);
+            break;
+        case Command::Image:
+            painter->drawImage(command.rect, command.image, command.sourceRect, command.imageFlags);
+            break;
+        case Command::TiledImage: {
+            // drawTiledPixmap() would need a QPixmap, a texture brush anchored
+            // at the same position gives the same result
+            QBrush brush(command.image);
+            brush.setTransform(QTransform::fromTranslate(command.rect.x() - command.offset.x(),
+                                                         command.rect.y() - command.offset.y()));
+            painter->save();
+            painter->setBrushOrigin(0, 0);
+            painter->fillRect(command.rect, brush);
+            painter->restore();
+            break;
+        }
+        case Command::Text: {
+            // Decorations are drawn by the text item instead of its font
+            QFont font = command.font;
+            font.setUnderline(command.textFlags & QTextItem::Underline);
+            font.setOverline(command.textFlags & QTextItem::Overline);
+            font.setStrikeOut(command.textFlags & QTextItem::StrikeOut);
+            painter->save();
+            painter->setFont(font);
+            painter->setLayoutDirection(command.textFlags & QTextItem::RightToLeft ? Qt::RightToLeft : Qt::LeftToRight);
+            painter->drawText(command.offset, command.text);
+            painter->restore();
+            break;
+        }
+        case Command::GlyphRun:
+            painter->drawGlyphRun(command.offset, command.glyphRun);
+            break;
+        }
+    }
+    painter->restore();
+}
+
+void DisplayList::replayState(const Command &command, QPainter *painter, const Base &base) const
+{
+    // Same order as QPainter flushes state to an engine, clips are given in
+    // the coordinates of the transform set before them
+    if(command.flags & QPaintEngine::DirtyPen)
+        painter->setPen(command.pen);
+    if(command.flags & QPaintEngine::DirtyBrush)
+        painter->setBrush(command.brush);
+    if(command.flags & QPaintEngine::DirtyBrushOrigin)
+        painter->setBrushOrigin(command.brushOrigin);
+    if(command.flags & QPaintEngine::DirtyBackground)
+        painter->setBackground(command.background);
+    if(command.flags & QPaintEngine::DirtyBackgroundMode)
+        painter->setBackgroundMode(command.backgroundMode);
+    if(command.flags & QPaintEngine::DirtyTransform)
+        painter->setWorldTransform(command.transform * base.transform);
+
+    // The recording starts without a clip, so QPainter turns its first
+    // intersection into a replacement and restore() starts over from no clip.
+    // Both have to start over from the clip the painter had instead.
+    if(command.flags & QPaintEngine::DirtyClipEnabled) {
+        if(command.clipEnabled)
+            painter->setClipping(true);
+        else
+            restoreClip(painter, base);
+    }
+    if(command.flags & (QPaintEngine::DirtyClipRegion | QPaintEngine::DirtyClipPath)) {
+        Qt::ClipOperation operation = command.clipOperation;
+        if(operation != Qt::IntersectClip) {
+            restoreClip(painter, base);
+            operation = base.clipped ? Qt::IntersectClip : Qt::ReplaceClip;
+        }
+        if(command.clipOperation != Qt::NoClip) {
+            if(command.flags & QPaintEngine::DirtyClipRegion)
+                painter->setClipRegion(command.clipRegion, operation);
+            else
+                painter->setClipPath(command.clipPath, operation);
+        }
+    }
+
+    if(command.flags & QPaintEngine::DirtyHints) {
+        painter->setRenderHints(painter->renderHints(), false);
+        painter->setRenderHints(command.hints);
+    }
+    if(command.flags & QPaintEngine::DirtyCompositionMode)
+        painter->setCompositionMode(command.compositionMode);
+    if(command.flags & QPaintEngine::DirtyOpacity)
+        painter->setOpacity(command.opacity * base.opacity);
+}
+
+void DisplayList::restoreClip(QPainter *painter, const Base &base) const
+{
+    if(!base.clipped) {
+        painter->setClipping(false);
+        return;
+    }
+    // The clip path is in the coordinates of the transform it was read with
+    const QTransform transform = painter->worldTransform();
+    painter->setWorldTransform(base.transform);
+    painter->setClipPath(base.clip, Qt::ReplaceClip);
+    painter->setWorldTransform(transform);
+}
+
+qint64 DisplayList::bytes() const
+{
+    qint64 total = qint64(commands.size()) * sizeof(Command);
+    foreach(const Command &command, commands) {
+        total += qint64(command.path.elementCount() + command.clipPath.elementCount()) * sizeof(QPainterPath::Element);
+        total += qint64(command.polygon.size()) * sizeof(QPointF);
+        total += qint64(command.rects.size()) * sizeof(QRectF);
+        total += qint64(command.lines.size()) * sizeof(QLineF);
+        total += qint64(command.text.size()) * sizeof(QChar);
+        // Glyph index and position of every glyph
+        total += qint64(command.glyphRun.glyphIndexes().size()) * (sizeof(quint32) + sizeof(QPointF));
+    }
+    return total;
+}
+
+DisplayList DisplayList::detached() const
+{
+    DisplayList copy;
+    copy.commands = commands;
+    for(int i = 0; i < copy.commands.size(); ++i) {
+        Command &command = copy.commands[i];
+        if(command.type == Command::Path)
+            command.path = deepCopy(command.path);
+        else if(command.flags & QPaintEngine::DirtyClipPath)
+            command.clipPath = deepCopy(command.clipPath);
+    }
+    return copy;
+}
+
+DisplayListRecorder::DisplayListRecorder(const QSize &size, int dpi, Output output) :
+    size(size),
+    dpi(dpi),
+    output(output),
+    engine(new DisplayListEngine(output == VectorOutput))
+{
+}
+
+DisplayListRecorder::~DisplayListRecorder()
+{
+}
+
+QPaintEngine *DisplayListRecorder::paintEngine() const
+{
+    return engine.data();
+}
+
+DisplayList DisplayListRecorder::displayList() const
+{
+    DisplayList list;
+    list.commands = engine->commands;
+    return list;
+}
+
+void DisplayListRecorder::drawGlyphRun(QPainter *painter, const QPointF &position, const QGlyphRun &glyphRun)
+{
+    Q_ASSERT(painter->device() == this);
+    if(output == RasterOutput) {
+        painter->drawGlyphRun(position, glyphRun);
+        return;
+    }
+
+    // QPainter hands state changes to the engine with the next drawing
+    // command, the glyphs need the pen and transform set before them
+    engine->syncState();
+    DisplayList::Command command;
+    command.type = DisplayList::Command::GlyphRun;
+    command.offset = position;
+    command.glyphRun = glyphRun;
+    engine->commands.append(command);
+}
+
+int DisplayListRecorder::metric(PaintDeviceMetric metric) const
+{
+    switch(metric) {
+    case PdmWidth:
+        return size.width();
+    case PdmHeight:
+        return size.height();
+    case PdmWidthMM:
+        return qRound(size.width() * 25.4 / dpi);
+    case PdmHeightMM:
+        return qRound(size.height() * 25.4 / dpi);
+    case PdmNumColors:
+        return INT_MAX;
+    case PdmDepth:
+        return 32;
+    case PdmDpiX:
+    case PdmDpiY:
+    case PdmPhysicalDpiX:
+    case PdmPhysicalDpiY:
+        return dpi;
+    default:
+        return QPaintDevice::metric(metric);
+    }
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef DISPLAYLIST_H
+#define DISPLAYLIST_H
+
+#include <QBrush>
+#include <QFont>
+#include <QGlyphRun>
+#include <QImage>
+#include <QPaintDevice>
+#include <QPaintEngine>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPen>
+#include <QPolygonF>
+#include <QRegion>
+#include <QScopedPointer>
+#include <QString>
+#include <QTransform>
+#include <QVector>
+
+class DisplayListEngine;
+
+// Painter commands recorded in memory. Unlike a QPicture nothing is
+// serialized: images stay implicitly shared QImages, so replaying doesn't
+// decode them again and a PDF embeds an image drawn on every page once.
+//
+// Recordings for raster output keep text as glyph outlines and can be
+// replayed in any thread. Recordings for vector output keep text as text so
+// that it stays text in a PDF, fonts can't be shared between threads so they
+// have to be replayed in the thread which recorded them.
+class DisplayList
+{
+public:
+    // Plays the commands on top of the painter's current transform, opacity
+    // and clip
+    void replay(QPainter *painter) const;
+
+    // Copy which shares no path data with this one. Painting fills caches
+    // inside paths, so every thread replaying the same recording needs a
+    // copy of its own.
+    DisplayList detached() const;
+
+    bool isEmpty() const { return commands.isEmpty(); }
+
+    // Approximate memory used by the commands, images are shared and not
+    // counted
+    qint64 bytes() const;
+private:
+    friend class DisplayListEngine;
+    friend class DisplayListRecorder;
+
+    struct Command
+    {
+        enum Type
+        {
+            State,
+            Path,
+            Polygon,
+            Rects,
+            Ellipse,
+            Lines,
+            Points,
+            Image,
+            TiledImage,
+            Text,
+            GlyphRun
+        };
+
+        Command() : type(State), flags(0), clipEnabled(false), clipOperation(Qt::NoClip),
+            compositionMode(QPainter::CompositionMode_SourceOver), opacity(1.0),
+            backgroundMode(Qt::TransparentMode), polygonMode(QPaintEngine::OddEvenMode),
+            imageFlags(Qt::AutoColor), textFlags(0) { }
+
+        Type type;
+
+        // Changed painter state, only the parts in flags are valid
+        QPaintEngine::DirtyFlags flags;
+        QPen pen;
+        QBrush brush;
+        QPointF brushOrigin;
+        QTransform transform;
+        bool clipEnabled;
+        Qt::ClipOperation clipOperation;
+        QRegion clipRegion;
+        QPainterPath clipPath;
+        QPainter::RenderHints hints;
+        QPainter::CompositionMode compositionMode;
+        qreal opacity;
+        Qt::BGMode backgroundMode;
+        QBrush background;
+
+        // Geometry of the drawing commands
+        QPainterPath path;
+        QPolygonF polygon;
+        QPaintEngine::PolygonDrawMode polygonMode;
+        QVector<QRectF> rects;
+        QVector<QLineF> lines;
+        QRectF rect;
+        QRectF sourceRect;
+        QPointF offset;
+        QImage image;
+        Qt::ImageConversionFlags imageFlags;
+        QString text;
+        QFont font;
+        QTextItem::RenderFlags textFlags;
+        QGlyphRun glyphRun;
+    };
+
+    // Painter state when replaying started
+    struct Base
+    {
+        QTransform transform;
+        qreal opacity;
+        bool clipped;
+        QPainterPath clip;
+    };
+
+    void replayState(const Command &command, QPainter *painter, const Base &base) const;
+    void restoreClip(QPainter *painter, const Base &base) const;
+
+    QVector<Command> commands;
+};
+
+// Paint device which records into a display list
+class DisplayListRecorder : public QPaintDevice
+{
+public:
+    enum Output
+    {
+        RasterOutput,
+        VectorOutput
+    };
+
+    // Raster fallbacks, image resampling and fonts use the size and
+    // resolution of the device, they should match what the recording is
+    // replayed into
+    DisplayListRecorder(const QSize &size, int dpi, Output output = RasterOutput);
+    virtual ~DisplayListRecorder();
+
+    QPaintEngine *paintEngine() const;
+
+    // Commands painted since the last QPainter::begin()
+    DisplayList displayList() const;
+
+    // Records text which has already been shaped. For vector output the
+    // glyphs are replayed as they are instead of shaping the text again, for
+    // raster output they become outlines like any other text. The painter
+    // has to be painting on this device.
+    void drawGlyphRun(QPainter *painter, const QPointF &position, const QGlyphRun &glyphRun);
+protected:
+    int metric(PaintDeviceMetric metric) const;
+private:
+    QSize size;
+    int dpi;
+    Output output;
+    QScopedPointer<DisplayListEngine> engine;
+};
+
+#endif // DISPLAYLIST_H
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "imagecache.h"
+#include "cachecost.h"
+
+#include <QCryptographicHash>
+
+uint qHash(const QSize &size, uint seed)
+{
+    return qHash((qint64(size.width()) << 32) | quint32(size.height()), seed);
+}
+
+ImageCache::ImageCache(qint64 maxCost)
+{
+    setMaxCost(maxCost);
+}
+
+void ImageCache::setMaxCost(qint64 bytes)
+{
+    // Resampled variants are usually smaller than their sources
+    images.setMaxCost(maxCacheCost(bytes / 4 * 3));
+    variants.setMaxCost(maxCacheCost(bytes / 4));
+}
+
+qint64 ImageCache::cost() const
+{
+    return cacheCostBytes(images.totalCost()) + cacheCostBytes(variants.totalCost());
+}
+
+QImage ImageCache::image(const QUrl &url, const QSize &sourceSize) const
+{
+    const QHash<SourceKey, QByteArray>::const_iterator it = sources.constFind(SourceKey(url, sourceSize));
+    if(it == sources.constEnd())
+        return QImage();
+
+    const QImage *image = images.object(it.value());
+    return image ? *image : QImage();
+}
+
+QImage ImageCache::insert(const QUrl &url, const QSize &sourceSize, const QImage &image)
+{
+    if(image.isNull())
+        return image;
+
+    const QByteArray hash = contentHash(image);
+    sources.insert(SourceKey(url, sourceSize), hash);
+
+    const QImage *shared = images.object(hash);
+    if(shared)
+        return *shared;
+
+    images.insert(hash, new QImage(image), cacheCost(imageBytes(image)));
+    return image;
+}
+
+QImage ImageCache::variant(const QImage &source, const QSize &size) const
+{
+    const QImage *image = variants.object(VariantKey(source.cacheKey(), size));
+    return image ? *image : QImage();
+}
+
+QImage ImageCache::insertVariant(const QImage &source, const QSize &size, const QImage &image)
+{
+    variants.insert(VariantKey(source.cacheKey(), size), new QImage(image), cacheCost(imageBytes(image)));
+    return image;
+}
+
+void ImageCache::clearVariants()
+{
+    variants.clear();
+}
+
+void ImageCache::clear()
+{
+    sources.clear();
+    images.clear();
+    variants.clear();
+}
+
+qint64 ImageCache::imageBytes(const QImage &image)
+{
+    return qint64(image.bytesPerLine()) * image.height();
+}
+
+QByteArray ImageCache::contentHash(const QImage &image)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    const int header[] = { image.width(), image.height(), image.format() };
+    hash.addData(reinterpret_cast<const char*>(header), sizeof(header));
+    // Hash line by line, the padding at the end of each scan line is undefined
+    const int lineLength = (image.width() * image.depth() + 7) / 8;
+    for(int y = 0; y < image.height(); ++y)
+        hash.addData(reinterpret_cast<const char*>(image.constScanLine(y)), lineLength);
+    return hash.result();
+}
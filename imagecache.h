@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QPair>
+#include <QSize>
+#include <QUrl>
+
+// Print job scoped cache for decoded images. Images are deduplicated by
+// content so every distinct image is backed by a single QImage. The PDF
+// engine embeds images once per QImage::cacheKey() and references that
+// object on every later draw, so a logo repeated on each page is only
+// stored once in the document.
+//
+// Decoded images are evicted once the cache grows past its maximum cost,
+// an evicted image is simply decoded again when it's needed.
+class ImageCache
+{
+public:
+    explicit ImageCache(qint64 maxCost = 256 * 1024 * 1024);
+
+    // Maximum size of the cached pixel data in bytes
+    void setMaxCost(qint64 bytes);
+    qint64 cost() const;
+
+    // Returns a null image if the source hasn't been loaded yet
+    QImage image(const QUrl &url, const QSize &sourceSize) const;
+
+    // Stores the decoded image and returns the shared instance to draw with,
+    // which may be an earlier image with identical content
+    QImage insert(const QUrl &url, const QSize &sourceSize, const QImage &image);
+
+    // Resampled or converted versions of a cached image, keyed by the source
+    // image so that repeated draws keep sharing a single PDF object
+    QImage variant(const QImage &source, const QSize &size) const;
+    QImage insertVariant(const QImage &source, const QSize &size, const QImage &image);
+    // Drops the variants when the conversion producing them changes
+    void clearVariants();
+
+    int uniqueImages() const { return images.size(); }
+
+    static qint64 imageBytes(const QImage &image);
+
+    void clear();
+private:
+    static QByteArray contentHash(const QImage &image);
+
+    typedef QPair<QUrl, QSize> SourceKey;
+    typedef QPair<qint64, QSize> VariantKey;
+
+    QHash<SourceKey, QByteArray> sources;
+    QCache<QByteArray, QImage> images;
+    QCache<VariantKey, QImage> variants;
+};
+
+uint qHash(const QSize &size, uint seed = 0);
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "imagepolicy.h"
+
+#include <QtMath>
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Don't bother resampling images which are only slightly too large
+const qreal resampleThreshold = 0.9;
+
+// Rows are converted with qGray's weights (11, 16, 5) / 32, the vector
+// kernels give exactly the same result as the scalar loop. AVX2 is used when
+// the project is built with qmlprinter_avx2, SSE2 is always there on x86-64.
+#if defined(__SSE2__)
+inline __m128i grayLanes(__m128i pixels)
+{
+    // Weights for B, G, R and A in memory order of ARGB32
+    const __m128i weights = _mm_set_epi16(0, 11, 16, 5, 0, 11, 16, 5);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+    __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+    low = _mm_add_epi32(low, _mm_srli_epi64(low, 32));
+    high = _mm_add_epi32(high, _mm_srli_epi64(high, 32));
+    const __m128i sums = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0)));
+    return _mm_srli_epi32(sums, 5);
+}
+#endif
+
+#if defined(__AVX2__)
+inline __m256i grayLanes(__m256i pixels)
+{
+    const __m256i weights = _mm256_set_epi16(0, 11, 16, 5, 0, 11, 16, 5, 0, 11, 16, 5, 0, 11, 16, 5);
+    const __m256i zero = _mm256_setzero_si256();
+    // Unpacking works within 128-bit lanes, the shuffle at the end puts the
+    // pixels back in order
+    __m256i low = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), weights);
+    __m256i high = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), weights);
+    low = _mm256_add_epi32(low, _mm256_srli_epi64(low, 32));
+    high = _mm256_add_epi32(high, _mm256_srli_epi64(high, 32));
+    const __m256i sums = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(2, 0, 2, 0)));
+    return _mm256_srli_epi32(sums, 5);
+}
+#endif
+
+// Gray with the alpha channel kept, works for premultiplied pixels as well
+void grayRow(const QRgb *source, QRgb *target, int count)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    const __m256i alphaMask256 = _mm256_set1_epi32(int(0xff000000));
+    for(; x + 8 <= count; x += 8) {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + x));
+        const __m256i gray = grayLanes(pixels);
+        __m256i result = _mm256_and_si256(pixels, alphaMask256);
+        result = _mm256_or_si256(result, gray);
+        result = _mm256_or_si256(result, _mm256_slli_epi32(gray, 8));
+        result = _mm256_or_si256(result, _mm256_slli_epi32(gray, 16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x), result);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+    for(; x + 4 <= count; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+        const __m128i gray = grayLanes(pixels);
+        __m128i result = _mm_and_si128(pixels, alphaMask);
+        result = _mm_or_si128(result, gray);
+        result = _mm_or_si128(result, _mm_slli_epi32(gray, 8));
+        result = _mm_or_si128(result, _mm_slli_epi32(gray, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), result);
+    }
+#endif
+    for(; x < count; ++x) {
+        const int value = qGray(source[x]);
+        target[x] = qRgba(value, value, value, qAlpha(source[x]));
+    }
+}
+
+// Gray of opaque pixels as 8-bit values
+void grayRow8(const QRgb *source, uchar *target, int count)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    for(; x + 8 <= count; x += 8) {
+        const __m256i gray = grayLanes(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + x)));
+        const __m256i words = _mm256_packs_epi32(gray, gray);
+        const __m256i bytes = _mm256_packus_epi16(words, words);
+        const quint32 first = quint32(_mm_cvtsi128_si32(_mm256_castsi256_si128(bytes)));
+        const quint32 second = quint32(_mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1)));
+        memcpy(target + x, &first, 4);
+        memcpy(target + x + 4, &second, 4);
+    }
+#endif
+#if defined(__SSE2__)
+    for(; x + 4 <= count; x += 4) {
+        const __m128i gray = grayLanes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x)));
+        const __m128i words = _mm_packs_epi32(gray, gray);
+        const quint32 bytes = quint32(_mm_cvtsi128_si32(_mm_packus_epi16(words, words)));
+        memcpy(target + x, &bytes, 4);
+    }
+#endif
+    for(; x < count; ++x)
+        target[x] = uchar(qGray(source[x]));
+}
+
+QImage toGrayscale(const QImage &image)
+{
+    if(!image.hasAlphaChannel()) {
+        const QImage source = image.convertToFormat(QImage::Format_RGB32);
+        QImage gray(source.size(), QImage::Format_Grayscale8);
+        gray.setDotsPerMeterX(source.dotsPerMeterX());
+        gray.setDotsPerMeterY(source.dotsPerMeterY());
+        for(int y = 0; y < source.height(); ++y)
+            grayRow8(reinterpret_cast<const QRgb*>(source.constScanLine(y)), gray.scanLine(y), source.width());
+        return gray;
+    }
+
+    // Premultiplied stays premultiplied, gray is a weighted sum so it doesn't
+    // need to be unpremultiplied first
+    const QImage::Format format = image.format() == QImage::Format_ARGB32_Premultiplied ? image.format() : QImage::Format_ARGB32;
+    QImage gray = image.convertToFormat(format);
+    for(int y = 0; y < gray.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb*>(gray.scanLine(y));
+        grayRow(line, line, gray.width());
+    }
+    return gray;
+}
+}
+
+ImagePolicy::ImagePolicy() :
+    targetDpi(0),
+    lossyPhotos(true),
+    lossyGraphics(false),
+    grayscale(false)
+{
+}
+
+QSize ImagePolicy::targetSize(const QSize &imageSize, const QSizeF &paperSize) const
+{
+    if(targetDpi <= 0 || paperSize.isEmpty())
+        return imageSize;
+
+    const qreal scale = qMax(paperSize.width() * targetDpi / imageSize.width(),
+                             paperSize.height() * targetDpi / imageSize.height());
+    if(scale >= resampleThreshold)
+        return imageSize;
+
+    return QSize(qMax(1, qCeil(imageSize.width() * scale)), qMax(1, qCeil(imageSize.height() * scale)));
+}
+
+QImage ImagePolicy::apply(const QImage &image, const QSize &size) const
+{
+    // QImage::scaled uses Qt's vectorised smooth scaler
+    QImage result = size != image.size() ? image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation) : image;
+    if(grayscale && !result.isGrayscale())
+        result = toGrayscale(result);
+    return result;
+}
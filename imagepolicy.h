@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef IMAGEPOLICY_H
+#define IMAGEPOLICY_H
+
+#include <QImage>
+#include <QSize>
+#include <QSizeF>
+
+// Controls how raster content ends up in the output
+struct ImagePolicy
+{
+    ImagePolicy();
+
+    // Images are downsampled so that they don't exceed this resolution on
+    // paper. Zero keeps the source resolution.
+    int targetDpi;
+    // Whether the PDF engine may use lossy (JPEG) compression for photographic
+    // sources (JPEG files) and for everything else (PNG graphics, screen grabs)
+    bool lossyPhotos;
+    bool lossyGraphics;
+    // Converts raster content to grayscale
+    bool grayscale;
+
+    // Size the image should be resampled to when it covers paperSize inches,
+    // returns the image size when no resampling is needed
+    QSize targetSize(const QSize &imageSize, const QSizeF &paperSize) const;
+
+    // Resamples and converts the image according to the policy
+    QImage apply(const QImage &image, const QSize &size) const;
+};
+
+#endif // IMAGEPOLICY_H
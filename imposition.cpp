@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "imposition.h"
+
+Imposition::Imposition()
+    : layout(NUp), columns(1), rows(1), duplex(false), gutter(0)
+{
+}
+
+Imposition Imposition::nUp(int columns, int rows, bool duplex)
+{
+    Imposition imposition;
+    imposition.layout = NUp;
+    imposition.columns = qMax(1, columns);
+    imposition.rows = qMax(1, rows);
+    imposition.duplex = duplex;
+    return imposition;
+}
+
+Imposition Imposition::booklet()
+{
+    Imposition imposition;
+    imposition.layout = Booklet;
+    imposition.columns = 2;
+    imposition.rows = 1;
+    imposition.duplex = true;
+    return imposition;
+}
+
+int Imposition::pagesPerSide() const
+{
+    return layout == Booklet ? 2 : qMax(1, columns) * qMax(1, rows);
+}
+
+QList<QList<int> > Imposition::sides(int pageCount) const
+{
+    QList<QList<int> > result;
+    if(pageCount <= 0)
+        return result;
+
+    if(layout == Booklet) {
+        // Padded to whole sheets, each sheet has four pages. The outermost
+        // sheet carries the first and the last page.
+        const int padded = (pageCount + 3) / 4 * 4;
+        for(int sheet = 0; sheet < padded / 4; ++sheet) {
+            QList<int> front;
+            front << padded - 1 - sheet * 2 << sheet * 2;
+            QList<int> back;
+            back << sheet * 2 + 1 << padded - 2 - sheet * 2;
+            result << front << back;
+        }
+        for(int i = 0; i < result.size(); ++i) {
+            for(int j = 0; j < result[i].size(); ++j) {
+                if(result[i][j] >= pageCount)
+                    result[i][j] = -1;
+            }
+        }
+        return result;
+    }
+
+    const int perSide = pagesPerSide();
+    for(int first = 0; first < pageCount; first += perSide) {
+        QList<int> side;
+        for(int i = 0; i < perSide; ++i) {
+            side << (first + i < pageCount ? first + i : -1);
+        }
+        result << side;
+    }
+    // Duplex output needs an even number of sides so that the next job
+    // starts on a new sheet
+    if(duplex && result.size() % 2 == 1)
+        result << QList<int>();
+    return result;
+}
+
+QList<QRectF> Imposition::cells(const QSizeF &sideSize) const
+{
+    const int columnCount = layout == Booklet ? 2 : qMax(1, columns);
+    const int rowCount = layout == Booklet ? 1 : qMax(1, rows);
+    const qreal width = (sideSize.width() - gutter * (columnCount + 1)) / columnCount;
+    const qreal height = (sideSize.height() - gutter * (rowCount + 1)) / rowCount;
+
+    QList<QRectF> result;
+    for(int row = 0; row < rowCount; ++row) {
+        for(int column = 0; column < columnCount; ++column) {
+            result << QRectF(gutter + column * (width + gutter), gutter + row * (height + gutter), width, height);
+        }
+    }
+    return result;
+}
+
+bool Imposition::landscape(const QSizeF &pageSize) const
+{
+    // The side takes the orientation which fits the pages the largest
+    const int columnCount = layout == Booklet ? 2 : qMax(1, columns);
+    const int rowCount = layout == Booklet ? 1 : qMax(1, rows);
+    return pageSize.width() * columnCount > pageSize.height() * rowCount;
+}
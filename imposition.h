@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef IMPOSITION_H
+#define IMPOSITION_H
+
+#include <QList>
+#include <QRectF>
+#include <QSizeF>
+
+// Places logical pages on the sides of physical sheets
+struct Imposition
+{
+    enum Layout {
+        // Columns x rows pages per side in reading order
+        NUp,
+        // Two pages per side ordered so that the folded stack of sheets reads
+        // in order, printed duplex flipping on the short edge
+        Booklet
+    };
+
+    Imposition();
+
+    Layout layout;
+    int columns;
+    int rows;
+    // Prints both sides of the sheets
+    bool duplex;
+    // Space between pages and around the edges of the sheet in device pixels
+    qreal gutter;
+
+    static Imposition nUp(int columns, int rows, bool duplex = false);
+    static Imposition booklet();
+
+    int pagesPerSide() const;
+    // Page indexes for each side of a sheet in order, -1 is a blank cell
+    QList<QList<int> > sides(int pageCount) const;
+    // Cells of one side in the order the pages of sides() are placed
+    QList<QRectF> cells(const QSizeF &sideSize) const;
+    // Whether the side should be landscape for pages of the given size
+    bool landscape(const QSizeF &pageSize) const;
+};
+
+#endif // IMPOSITION_H
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "itemproperties.h"
+
+#include <QJSValue>
+#include <QQmlListReference>
+#include <QMutex>
+#include <QThreadStorage>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const PropertyDescriptor rectangleDescriptors[] = {
+    { "color", QMetaType::QColor },
+    { "border", QMetaType::QObjectStar },
+    { "radius", QMetaType::QReal },
+    { "gradient", QMetaType::QVariant }
+};
+
+const PropertyDescriptor gradientDescriptors[] = {
+    { "orientation", QMetaType::Int }
+};
+
+const PropertyDescriptor gradientStopDescriptors[] = {
+    { "position", QMetaType::QReal },
+    { "color", QMetaType::QColor }
+};
+
+const PropertyDescriptor penDescriptors[] = {
+    { "width", QMetaType::QReal },
+    { "color", QMetaType::QColor }
+};
+
+const PropertyDescriptor textDescriptors[] = {
+    { "font", QMetaType::QFont },
+    { "text", QMetaType::QString },
+    { "color", QMetaType::QColor },
+    { "wrapMode", QMetaType::Int },
+    { "textFormat", QMetaType::Int },
+    { "horizontalAlignment", QMetaType::Int },
+    { "verticalAlignment", QMetaType::Int },
+    { "elide", QMetaType::Int }
+};
+
+const PropertyDescriptor imageDescriptors[] = {
+    { "source", QMetaType::QUrl },
+    { "fillMode", QMetaType::Int },
+    { "sourceSize", QMetaType::QSize },
+    { "horizontalAlignment", QMetaType::Int },
+    { "verticalAlignment", QMetaType::Int },
+    { "mirror", QMetaType::Bool }
+};
+
+bool isDirectlyReadable(const QMetaProperty &property, int type)
+{
+    if(property.userType() == type)
+        return true;
+    // Enums are stored as ints and QObject derived pointers as QObject*
+    if(type == QMetaType::Int && property.isEnumType())
+        return true;
+    if(type == QMetaType::QObjectStar && (QMetaType::typeFlags(property.userType()) & QMetaType::PointerToQObject))
+        return true;
+    return false;
+}
+
+QObject *gradientObject(const QVariant &value)
+{
+    // Since Qt 5.12 Rectangle.gradient is a QJSValue so that it can also hold
+    // a preset, older versions expose the QQuickGradient directly
+    if(value.userType() == qMetaTypeId<QJSValue>())
+        return value.value<QJSValue>().toQObject();
+    return value.value<QObject*>();
+}
+
+void readGradient(QObject *gradient, RectangleProperties &properties)
+{
+    const QVector<PropertyIndexCache::Entry> &entries = PropertyIndexCache::resolve(gradient, gradientDescriptors);
+    int orientation = Qt::Vertical;
+    PropertyIndexCache::read(gradient, entries.at(0), orientation);
+    properties.gradientOrientation = orientation == Qt::Horizontal ? Qt::Horizontal : Qt::Vertical;
+
+    QQmlListReference stops(gradient, "stops");
+    for(int i = 0; i < stops.count(); ++i) {
+        QObject *stop = stops.at(i);
+        if(!stop)
+            continue;
+        const QVector<PropertyIndexCache::Entry> &stopEntries = PropertyIndexCache::resolve(stop, gradientStopDescriptors);
+        qreal position = 0;
+        QColor color;
+        PropertyIndexCache::read(stop, stopEntries.at(0), position);
+        PropertyIndexCache::read(stop, stopEntries.at(1), color);
+        properties.gradientStops.append(QGradientStop(qBound<qreal>(0, position, 1), color));
+    }
+    std::stable_sort(properties.gradientStops.begin(), properties.gradientStops.end(),
+                     [](const QGradientStop &a, const QGradientStop &b) { return a.first < b.first; });
+}
+
+}
+
+const QMetaObject *PropertyIndexCache::classMetaObject(const QObject *object)
+{
+    // Types declared in QML get their own (possibly per instance) meta object.
+    // The properties we read are declared by the C++ class so resolve them there.
+    const QMetaObject *metaObject = object->metaObject();
+    while(metaObject->superClass() && strstr(metaObject->className(), "_QML"))
+        metaObject = metaObject->superClass();
+    return metaObject;
+}
+
+const QVector<PropertyIndexCache::Entry> &PropertyIndexCache::resolve(const QMetaObject *metaObject, const PropertyDescriptor *descriptors, int count)
+{
+    typedef QPair<const QMetaObject*, const PropertyDescriptor*> Key;
+    // Every thread looks classes up in a copy of its own without locking.
+    // Only the first lookup of a class in a thread goes to the shared cache,
+    // whose entries are never removed. The nodes of a QHash don't move on
+    // insertion, so references into it stay valid after the lock is released.
+    static QThreadStorage<QHash<Key, const QVector<Entry>*> > local;
+    static QHash<Key, QVector<Entry> > shared;
+    static QMutex mutex;
+
+    const Key key(metaObject, descriptors);
+    QHash<Key, const QVector<Entry>*> &resolved = local.localData();
+    if(const QVector<Entry> *entries = resolved.value(key))
+        return *entries;
+
+    QMutexLocker locker(&mutex);
+    QHash<Key, QVector<Entry> >::iterator it = shared.find(key);
+    if(it == shared.end()) {
+        QVector<Entry> entries(count);
+        for(int i = 0; i < count; ++i) {
+            Entry &entry = entries[i];
+            entry.index = metaObject->indexOfProperty(descriptors[i].name);
+            entry.direct = entry.index >= 0 && isDirectlyReadable(metaObject->property(entry.index), descriptors[i].type);
+        }
+        it = shared.insert(key, entries);
+    }
+    resolved.insert(key, &it.value());
+    return it.value();
+}
+
+RectangleProperties::RectangleProperties() :
+    borderWidth(0),
+    radius(0),
+    gradientOrientation(Qt::Vertical)
+{
+}
+
+RectangleProperties RectangleProperties::read(QObject *item)
+{
+    const QVector<PropertyIndexCache::Entry> &entries = PropertyIndexCache::resolve(item, rectangleDescriptors);
+
+    RectangleProperties properties;
+    QObject *border = nullptr;
+    PropertyIndexCache::read(item, entries.at(0), properties.color);
+    PropertyIndexCache::read(item, entries.at(1), border);
+    PropertyIndexCache::read(item, entries.at(2), properties.radius);
+
+    QVariant gradient;
+    PropertyIndexCache::read(item, entries.at(3), gradient);
+    if(QObject *gradientObj = gradientObject(gradient))
+        readGradient(gradientObj, properties);
+
+    if(border) {
+        const QVector<PropertyIndexCache::Entry> &penEntries = PropertyIndexCache::resolve(border, penDescriptors);
+        PropertyIndexCache::read(border, penEntries.at(0), properties.borderWidth);
+        PropertyIndexCache::read(border, penEntries.at(1), properties.borderColor);
+    }
+    return properties;
+}
+
+TextProperties::TextProperties() :
+    wrapMode(0),
+    textFormat(0),
+    horizontalAlignment(0),
+    verticalAlignment(0),
+    elide(0)
+{
+}
+
+TextProperties TextProperties::read(QObject *item)
+{
+    const QVector<PropertyIndexCache::Entry> &entries = PropertyIndexCache::resolve(item, textDescriptors);
+
+    TextProperties properties;
+    PropertyIndexCache::read(item, entries.at(0), properties.font);
+    PropertyIndexCache::read(item, entries.at(1), properties.text);
+    PropertyIndexCache::read(item, entries.at(2), properties.color);
+    PropertyIndexCache::read(item, entries.at(3), properties.wrapMode);
+    PropertyIndexCache::read(item, entries.at(4), properties.textFormat);
+    PropertyIndexCache::read(item, entries.at(5), properties.horizontalAlignment);
+    PropertyIndexCache::read(item, entries.at(6), properties.verticalAlignment);
+    PropertyIndexCache::read(item, entries.at(7), properties.elide);
+    return properties;
+}
+
+ImageProperties::ImageProperties() :
+    fillMode(0),
+    horizontalAlignment(Qt::AlignHCenter),
+    verticalAlignment(Qt::AlignVCenter),
+    mirror(false)
+{
+}
+
+ImageProperties ImageProperties::read(QObject *item)
+{
+    const QVector<PropertyIndexCache::Entry> &entries = PropertyIndexCache::resolve(item, imageDescriptors);
+
+    ImageProperties properties;
+    PropertyIndexCache::read(item, entries.at(0), properties.source);
+    PropertyIndexCache::read(item, entries.at(1), properties.fillMode);
+    PropertyIndexCache::read(item, entries.at(2), properties.sourceSize);
+    PropertyIndexCache::read(item, entries.at(3), properties.horizontalAlignment);
+    PropertyIndexCache::read(item, entries.at(4), properties.verticalAlignment);
+    PropertyIndexCache::read(item, entries.at(5), properties.mirror);
+    return properties;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef ITEMPROPERTIES_H
+#define ITEMPROPERTIES_H
+
+#include <QColor>
+#include <QFont>
+#include <QGradient>
+#include <QHash>
+#include <QMetaObject>
+#include <QMetaProperty>
+#include <QObject>
+#include <QPair>
+#include <QSize>
+#include <QString>
+#include <QUrl>
+#include <QVector>
+
+struct PropertyDescriptor
+{
+    const char *name;
+    int type;
+};
+
+// Resolves property names to QMetaProperty indices once per class. Properties
+// whose type matches the requested type are read straight into typed storage
+// through QMetaObject::metacall which skips both the name lookup and the
+// QVariant allocation of QObject::property. Resolved classes are shared by
+// all threads, every thread keeps its own index of them so that lookups
+// don't take a lock.
+class PropertyIndexCache
+{
+public:
+    struct Entry
+    {
+        int index;
+        bool direct;
+    };
+
+    template<int N>
+    static const QVector<Entry> &resolve(const QObject *object, const PropertyDescriptor (&descriptors)[N])
+    {
+        return resolve(classMetaObject(object), descriptors, N);
+    }
+
+    template<typename T>
+    static void read(QObject *object, const Entry &entry, T &value)
+    {
+        if(entry.index < 0)
+            return;
+
+        if(entry.direct) {
+            int status = -1;
+            int flags = 0;
+            void *argv[] = { &value, nullptr, &status, &flags };
+            QMetaObject::metacall(object, QMetaObject::ReadProperty, entry.index, argv);
+        } else {
+            value = object->metaObject()->property(entry.index).read(object).value<T>();
+        }
+    }
+private:
+    static const QMetaObject *classMetaObject(const QObject *object);
+    static const QVector<Entry> &resolve(const QMetaObject *metaObject, const PropertyDescriptor *descriptors, int count);
+};
+
+struct RectangleProperties
+{
+    RectangleProperties();
+
+    QColor color;
+    qreal borderWidth;
+    QColor borderColor;
+    qreal radius;
+    // Empty when the rectangle has no gradient
+    QGradientStops gradientStops;
+    Qt::Orientation gradientOrientation;
+
+    static RectangleProperties read(QObject *item);
+};
+
+struct TextProperties
+{
+    TextProperties();
+
+    QFont font;
+    QString text;
+    QColor color;
+    int wrapMode;
+    int textFormat;
+    int horizontalAlignment;
+    int verticalAlignment;
+    int elide;
+
+    static TextProperties read(QObject *item);
+};
+
+struct ImageProperties
+{
+    ImageProperties();
+
+    QUrl source;
+    int fillMode;
+    QSize sourceSize;
+    int horizontalAlignment;
+    int verticalAlignment;
+    bool mirror;
+
+    static ImageProperties read(QObject *item);
+};
+
+#endif // ITEMPROPERTIES_H
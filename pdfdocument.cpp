@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "pdfdocument.h"
+
+#include <climits>
+
+namespace {
+
+// Page attributes which may be inherited from the page tree
+const char *const inheritedAttributes[] = { "/Resources", "/MediaBox", "/CropBox", "/Rotate" };
+
+struct Token
+{
+    enum Type { End, Integer, Real, Name, String, Keyword, ArrayOpen, ArrayClose, DictOpen, DictClose };
+
+    Token() : type(End), begin(0), end(0) { }
+
+    Type type;
+    qint64 begin;
+    qint64 end;
+};
+
+bool isWhitespace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+}
+
+bool isDelimiter(char c)
+{
+    return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']'
+            || c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+class Lexer
+{
+public:
+    Lexer(const char *data, qint64 size, qint64 position = 0)
+        : data(data), size(size), pos(position) { }
+
+    qint64 position() const { return pos; }
+    void setPosition(qint64 position) { pos = position; }
+
+    QByteArray text(const Token &token) const
+    {
+        return QByteArray(data + token.begin, int(token.end - token.begin));
+    }
+
+    bool isKeyword(const Token &token, const char *keyword) const
+    {
+        return token.type == Token::Keyword && text(token) == keyword;
+    }
+
+    Token next()
+    {
+        skipWhitespace();
+        Token token;
+        token.begin = pos;
+        if(pos >= size) {
+            token.end = pos;
+            return token;
+        }
+
+        const char c = data[pos];
+        if(c == '[') {
+            token.type = Token::ArrayOpen;
+            ++pos;
+        } else if(c == ']') {
+            token.type = Token::ArrayClose;
+            ++pos;
+        } else if(c == '<' && pos + 1 < size && data[pos + 1] == '<') {
+            token.type = Token::DictOpen;
+            pos += 2;
+        } else if(c == '>' && pos + 1 < size && data[pos + 1] == '>') {
+            token.type = Token::DictClose;
+            pos += 2;
+        } else if(c == '<') {
+            token.type = Token::String;
+            while(pos < size && data[pos] != '>')
+                ++pos;
+            ++pos;
+        } else if(c == '(') {
+            token.type = Token::String;
+            skipLiteralString();
+        } else if(c == '/') {
+            token.type = Token::Name;
+            ++pos;
+            skipRegular();
+        } else if(c == '{' || c == '}' || c == ')' || c == '>') {
+            token.type = Token::Keyword;
+            ++pos;
+        } else {
+            skipRegular();
+            token.type = numberType(token.begin, pos);
+        }
+        token.end = qMin(pos, size);
+        return token;
+    }
+
+    // Consumes the rest of a value which starts with the given token
+    void skipValue(const Token &first)
+    {
+        if(first.type == Token::DictOpen || first.type == Token::ArrayOpen) {
+            int depth = 1;
+            while(depth > 0) {
+                const Token token = next();
+                if(token.type == Token::End)
+                    return;
+                if(token.type == Token::DictOpen || token.type == Token::ArrayOpen)
+                    ++depth;
+                else if(token.type == Token::DictClose || token.type == Token::ArrayClose)
+                    --depth;
+            }
+        } else if(first.type == Token::Integer) {
+            // Either a plain integer or the start of a reference
+            const qint64 start = pos;
+            const Token generation = next();
+            const Token keyword = next();
+            if(generation.type != Token::Integer || !isKeyword(keyword, "R"))
+                pos = start;
+        }
+    }
+private:
+    void skipWhitespace()
+    {
+        while(pos < size) {
+            if(isWhitespace(data[pos])) {
+                ++pos;
+            } else if(data[pos] == '%') {
+                while(pos < size && data[pos] != '\n' && data[pos] != '\r')
+                    ++pos;
+            } else {
+                break;
+            }
+        }
+    }
+
+    void skipRegular()
+    {
+        while(pos < size && !isWhitespace(data[pos]) && !isDelimiter(data[pos]))
+            ++pos;
+    }
+
+    void skipLiteralString()
+    {
+        int depth = 0;
+        while(pos < size) {
+            const char c = data[pos++];
+            if(c == '\\') {
+                ++pos;
+            } else if(c == '(') {
+                ++depth;
+            } else if(c == ')') {
+                if(--depth == 0)
+                    return;
+            }
+        }
+    }
+
+    Token::Type numberType(qint64 begin, qint64 end) const
+    {
+        bool digits = false;
+        bool dot = false;
+        for(qint64 i = begin; i < end; ++i) {
+            const char c = data[i];
+            if(c >= '0' && c <= '9')
+                digits = true;
+            else if(c == '.' && !dot)
+                dot = true;
+            else if(!((c == '+' || c == '-') && i == begin))
+                return Token::Keyword;
+        }
+        if(!digits)
+            return Token::Keyword;
+        return dot ? Token::Real : Token::Integer;
+    }
+
+    const char *data;
+    qint64 size;
+    qint64 pos;
+};
+
+// Finds the value of key in the top level dictionary and returns its byte range
+bool findValue(const QByteArray &object, const QByteArray &key, Token &begin, qint64 &end)
+{
+    Lexer lexer(object.constData(), PdfDocument::streamOffset(object));
+    if(lexer.next().type != Token::DictOpen)
+        return false;
+    for(;;) {
+        const Token name = lexer.next();
+        if(name.type != Token::Name)
+            return false;
+        const Token first = lexer.next();
+        if(first.type == Token::End || first.type == Token::DictClose)
+            return false;
+        lexer.skipValue(first);
+        if(lexer.text(name) == key) {
+            begin = first;
+            end = lexer.position();
+            return true;
+        }
+    }
+}
+
+}
+
+PdfDocument::PdfDocument()
+    : data(nullptr), dataSize(0), objectCount(0)
+{
+}
+
+bool PdfDocument::open(const QString &fileName)
+{
+    close();
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    dataSize = file.size();
+    data = reinterpret_cast<const char*>(file.map(0, dataSize));
+    if(!data || dataSize < 8 || qstrncmp(data, "%PDF-", 5) != 0) {
+        close();
+        return false;
+    }
+
+    // startxref is within the last few bytes of the file
+    const qint64 tailSize = qMin<qint64>(dataSize, 1024);
+    const QByteArray tail = QByteArray::fromRawData(data + dataSize - tailSize, int(tailSize));
+    const int startxref = tail.lastIndexOf("startxref");
+    if(startxref < 0) {
+        close();
+        return false;
+    }
+    Lexer lexer(data, dataSize, dataSize - tailSize + startxref + 9);
+    const Token offset = lexer.next();
+    if(offset.type != Token::Integer || !readCrossReference(lexer.text(offset).toLongLong())) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PdfDocument::close()
+{
+    if(file.isOpen()) {
+        if(data)
+            file.unmap(reinterpret_cast<uchar*>(const_cast<char*>(data)));
+        file.close();
+    }
+    data = nullptr;
+    dataSize = 0;
+    offsets.clear();
+    trailerDictionary.clear();
+    objectCount = 0;
+}
+
+bool PdfDocument::isOpen() const
+{
+    return data != nullptr;
+}
+
+QByteArray PdfDocument::version() const
+{
+    if(!data)
+        return QByteArray();
+    return QByteArray(data + 5, 3);
+}
+
+int PdfDocument::size() const
+{
+    return objectCount;
+}
+
+bool PdfDocument::contains(int number) const
+{
+    return offsets.contains(number);
+}
+
+QByteArray PdfDocument::object(int number) const
+{
+    const QHash<int, qint64>::const_iterator it = offsets.constFind(number);
+    if(it == offsets.constEnd())
+        return QByteArray();
+    return readObject(it.value());
+}
+
+QByteArray PdfDocument::trailer() const
+{
+    return trailerDictionary;
+}
+
+qint64 PdfDocument::fileSize() const
+{
+    return dataSize;
+}
+
+int PdfDocument::root() const
+{
+    return reference(trailerDictionary, "/Root");
+}
+
+int PdfDocument::info() const
+{
+    return reference(trailerDictionary, "/Info");
+}
+
+QList<int> PdfDocument::pages() const
+{
+    QList<int> result;
+    const int catalog = root();
+    if(catalog < 0)
+        return result;
+    collectPages(reference(object(catalog), "/Pages"), result, 0);
+    return result;
+}
+
+QByteArray PdfDocument::pageAttribute(int page, const QByteArray &key) const
+{
+    // The depth limit protects against cycles in broken files
+    int node = page;
+    for(int depth = 0; node >= 0 && depth < 64; ++depth) {
+        const QByteArray dictionary = object(node);
+        const QByteArray result = value(dictionary, key);
+        if(!result.isEmpty())
+            return result;
+        node = reference(dictionary, "/Parent");
+    }
+    return QByteArray();
+}
+
+QByteArray PdfDocument::flattenedPage(int page) const
+{
+    QByteArray body = object(page);
+    for(size_t i = 0; i < sizeof(inheritedAttributes) / sizeof(inheritedAttributes[0]); ++i) {
+        const QByteArray key(inheritedAttributes[i]);
+        if(value(body, key).isEmpty()) {
+            const QByteArray inherited = pageAttribute(page, key);
+            if(!inherited.isEmpty())
+                body = withValue(body, key, inherited);
+        }
+    }
+    return body;
+}
+
+void PdfDocument::collectPages(int node, QList<int> &result, int depth) const
+{
+    if(node < 0 || depth > 64)
+        return;
+    const QByteArray dictionary = object(node);
+    if(value(dictionary, "/Type").trimmed() == "/Page") {
+        result << node;
+        return;
+    }
+    foreach(const Reference &kid, references(value(dictionary, "/Kids"))) {
+        collectPages(kid.number, result, depth + 1);
+    }
+}
+
+QList<PdfDocument::Reference> PdfDocument::references(const QByteArray &object)
+{
+    QList<Reference> result;
+    Lexer lexer(object.constData(), streamOffset(object));
+    // The last three tokens, a reference is "key number generation R"
+    Token previous[3];
+    for(;;) {
+        const Token token = lexer.next();
+        if(token.type == Token::End)
+            break;
+        if(lexer.isKeyword(token, "R") && previous[2].type == Token::Integer && previous[1].type == Token::Integer) {
+            Reference reference;
+            reference.number = lexer.text(previous[1]).toInt();
+            reference.begin = int(previous[1].begin);
+            reference.end = int(token.end);
+            if(previous[0].type == Token::Name)
+                reference.key = lexer.text(previous[0]);
+            result << reference;
+        }
+        previous[0] = previous[1];
+        previous[1] = previous[2];
+        previous[2] = token;
+    }
+    return result;
+}
+
+QByteArray PdfDocument::renumbered(const QByteArray &object, const QHash<int, int> &numbers, int parent)
+{
+    QByteArray result;
+    result.reserve(object.size());
+    int position = 0;
+    foreach(const Reference &reference, references(object)) {
+        result.append(object.constData() + position, reference.begin - position);
+        if(parent >= 0 && reference.key == "/Parent")
+            result.append(QByteArray::number(parent));
+        else
+            result.append(QByteArray::number(numbers.value(reference.number, reference.number)));
+        result.append(" 0 R");
+        position = reference.end;
+    }
+    result.append(object.constData() + position, object.size() - position);
+    return result;
+}
+
+QByteArray PdfDocument::value(const QByteArray &object, const QByteArray &key)
+{
+    Token begin;
+    qint64 end = 0;
+    if(!findValue(object, key, begin, end))
+        return QByteArray();
+    return object.mid(int(begin.begin), int(end - begin.begin));
+}
+
+int PdfDocument::reference(const QByteArray &object, const QByteArray &key)
+{
+    const QList<Reference> found = references(value(object, key));
+    if(found.isEmpty())
+        return -1;
+    return found.first().number;
+}
+
+int PdfDocument::streamOffset(const QByteArray &object)
+{
+    Lexer lexer(object.constData(), object.size());
+    const Token first = lexer.next();
+    if(first.type == Token::End)
+        return object.size();
+    lexer.skipValue(first);
+    const Token keyword = lexer.next();
+    if(lexer.isKeyword(keyword, "stream"))
+        return int(keyword.begin);
+    return object.size();
+}
+
+QByteArray PdfDocument::withValue(const QByteArray &object, const QByteArray &key, const QByteArray &value)
+{
+    const int open = object.indexOf("<<");
+    if(open < 0 || open >= streamOffset(object))
+        return object;
+    QByteArray result = object;
+    result.insert(open + 2, "\n" + key + " " + value);
+    return result;
+}
+
+bool PdfDocument::readCrossReference(qint64 offset)
+{
+    // Later sections take precedence, each one is read at most once
+    QList<qint64> visited;
+    while(offset > 0 && offset < dataSize && !visited.contains(offset)) {
+        visited << offset;
+        Lexer lexer(data, dataSize, offset);
+        if(!lexer.isKeyword(lexer.next(), "xref"))
+            return false;
+
+        for(;;) {
+            const Token first = lexer.next();
+            if(lexer.isKeyword(first, "trailer"))
+                break;
+            const Token count = lexer.next();
+            if(first.type != Token::Integer || count.type != Token::Integer)
+                return false;
+            const int start = lexer.text(first).toInt();
+            const int entries = lexer.text(count).toInt();
+            for(int i = 0; i < entries; ++i) {
+                const Token entryOffset = lexer.next();
+                const Token generation = lexer.next();
+                const Token type = lexer.next();
+                if(entryOffset.type != Token::Integer || generation.type != Token::Integer)
+                    return false;
+                const int number = start + i;
+                objectCount = qMax(objectCount, number + 1);
+                if(lexer.isKeyword(type, "n") && !offsets.contains(number))
+                    offsets.insert(number, lexer.text(entryOffset).toLongLong());
+            }
+        }
+
+        const Token dictionary = lexer.next();
+        if(dictionary.type != Token::DictOpen)
+            return false;
+        lexer.skipValue(dictionary);
+        const QByteArray trailer(data + dictionary.begin, int(lexer.position() - dictionary.begin));
+        if(trailerDictionary.isEmpty())
+            trailerDictionary = trailer;
+
+        const QByteArray previous = value(trailer, "/Prev");
+        offset = previous.isEmpty() ? 0 : previous.trimmed().toLongLong();
+    }
+    return !trailerDictionary.isEmpty();
+}
+
+QByteArray PdfDocument::readObject(qint64 offset) const
+{
+    Lexer lexer(data, dataSize, offset);
+    const Token number = lexer.next();
+    const Token generation = lexer.next();
+    if(number.type != Token::Integer || generation.type != Token::Integer || !lexer.isKeyword(lexer.next(), "obj"))
+        return QByteArray();
+
+    const qint64 begin = lexer.position();
+    const Token first = lexer.next();
+    lexer.skipValue(first);
+    const Token keyword = lexer.next();
+
+    qint64 end = keyword.begin;
+    if(lexer.isKeyword(keyword, "stream")) {
+        qint64 streamBegin = keyword.end;
+        if(streamBegin < dataSize && data[streamBegin] == '\r')
+            ++streamBegin;
+        if(streamBegin < dataSize && data[streamBegin] == '\n')
+            ++streamBegin;
+
+        // The length is often an indirect object written after the stream
+        const QByteArray header(data + begin, int(keyword.begin - begin));
+        qint64 length = -1;
+        const int lengthReference = reference(header, "/Length");
+        if(lengthReference >= 0)
+            length = object(lengthReference).trimmed().toLongLong();
+        else
+            length = value(header, "/Length").trimmed().toLongLong();
+
+        const QByteArray endstream("endstream");
+        Lexer check(data, dataSize, qMin(streamBegin + qMax<qint64>(length, 0), dataSize));
+        const Token streamEnd = check.next();
+        if(length >= 0 && check.isKeyword(streamEnd, "endstream")) {
+            end = streamEnd.end;
+        } else {
+            // Fall back to searching for the end of the stream
+            const QByteArray rest = QByteArray::fromRawData(data + streamBegin, int(qMin<qint64>(dataSize - streamBegin, INT_MAX)));
+            const int found = rest.indexOf(endstream);
+            if(found < 0)
+                return QByteArray();
+            end = streamBegin + found + endstream.size();
+        }
+    } else if(!lexer.isKeyword(keyword, "endobj")) {
+        // Broken object, keep only the value
+        end = keyword.begin;
+    }
+    return QByteArray(data + begin, int(end - begin));
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef PDFDOCUMENT_H
+#define PDFDOCUMENT_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+// Minimal reader for the PDF files written by QPrinter. The file is memory
+// mapped and objects are located through the classic cross-reference table,
+// cross-reference streams and object streams are not supported as Qt doesn't
+// write them.
+//
+// Objects are handled as raw bytes, the part before the stream keyword is
+// tokenized to find and rewrite indirect references while stream data is
+// copied as is.
+class PdfDocument
+{
+public:
+    // Indirect reference "N G R" inside an object
+    struct Reference
+    {
+        int number;
+        // Byte range of the reference in the object
+        int begin;
+        int end;
+        // Dictionary key directly in front of the reference, if any
+        QByteArray key;
+    };
+
+    PdfDocument();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+
+    // Version from the header, for example "1.4"
+    QByteArray version() const;
+    // One past the highest object number
+    int size() const;
+    bool contains(int number) const;
+
+    // Everything between "N G obj" and "endobj", including stream data
+    QByteArray object(int number) const;
+    QByteArray trailer() const;
+    qint64 fileSize() const;
+
+    int root() const;
+    int info() const;
+    // Page objects in document order
+    QList<int> pages() const;
+    // Closest value of an inheritable page attribute such as /MediaBox
+    QByteArray pageAttribute(int page, const QByteArray &key) const;
+    // Page object with the attributes it inherits from the page tree copied
+    // into it, for moving the page under another tree
+    QByteArray flattenedPage(int page) const;
+
+    static QList<Reference> references(const QByteArray &object);
+    // Rewrites references with the given object numbers, generation is always
+    // 0. A /Parent reference is replaced with parent when it's given.
+    static QByteArray renumbered(const QByteArray &object, const QHash<int, int> &numbers, int parent = -1);
+    // Raw bytes of a value in the top level dictionary of the object
+    static QByteArray value(const QByteArray &object, const QByteArray &key);
+    // Object number of a reference in the top level dictionary, -1 if missing
+    static int reference(const QByteArray &object, const QByteArray &key);
+    // Offset of the stream keyword, or the size of the object if it isn't a stream
+    static int streamOffset(const QByteArray &object);
+    // Adds an entry to the top level dictionary
+    static QByteArray withValue(const QByteArray &object, const QByteArray &key, const QByteArray &value);
+private:
+    bool readCrossReference(qint64 offset);
+    QByteArray readObject(qint64 offset) const;
+    void collectPages(int node, QList<int> &result, int depth) const;
+
+    QFile file;
+    const char *data;
+    qint64 dataSize;
+    QHash<int, qint64> offsets;
+    QByteArray trailerDictionary;
+    int objectCount;
+};
+
+#endif // PDFDOCUMENT_H
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "pdflinearizer.h"
+
+#include <QFile>
+
+namespace {
+
+// Values which are only known after the layout are written with a fixed
+// width so that the layout doesn't change when they are filled in
+QByteArray fixedWidth(qint64 value)
+{
+    return QByteArray::number(value).leftJustified(10, ' ');
+}
+
+QByteArray crossReferenceEntry(qint64 offset)
+{
+    return QByteArray::number(offset).rightJustified(10, '0') + " 00000 n \n";
+}
+
+int bitsNeeded(qint64 value)
+{
+    int bits = 0;
+    while(value > 0) {
+        ++bits;
+        value >>= 1;
+    }
+    return bits;
+}
+
+// Big endian bit packing used by the hint tables
+class BitWriter
+{
+public:
+    BitWriter() : current(0), used(0) { }
+
+    void write(quint64 value, int bits)
+    {
+        for(int i = bits - 1; i >= 0; --i) {
+            current = quint8((current << 1) | ((value >> i) & 1));
+            if(++used == 8) {
+                data.append(char(current));
+                current = 0;
+                used = 0;
+            }
+        }
+    }
+
+    // Every item of a hint table starts at a byte boundary
+    void flush()
+    {
+        if(used > 0)
+            write(0, 8 - used);
+    }
+
+    QByteArray data;
+private:
+    quint8 current;
+    int used;
+};
+
+}
+
+PdfLinearizer::PdfLinearizer()
+    : pagesRoot(0), firstPageNumber(0), objectCount(0)
+{
+}
+
+QString PdfLinearizer::errorString() const
+{
+    return error;
+}
+
+bool PdfLinearizer::linearize(const QString &input, const QString &output)
+{
+    error.clear();
+    numbers.clear();
+    pageSet.clear();
+
+    if(!document.open(input)) {
+        error = QString("Unable to read %1").arg(input);
+        return false;
+    }
+    pages = document.pages();
+    if(pages.isEmpty()) {
+        error = "The document has no pages";
+        return false;
+    }
+    foreach(int page, pages) {
+        pageSet.insert(page);
+    }
+
+    // Objects used by each page and how many pages use them
+    QList<QList<int> > used;
+    QHash<int, int> usage;
+    foreach(int page, pages) {
+        const QList<int> objects = reachable(page);
+        foreach(int object, objects) {
+            ++usage[object];
+        }
+        used << objects;
+    }
+
+    // Everything the first page needs goes into the first page section,
+    // shared objects included
+    QSet<int> assigned;
+    QList<int> firstPage;
+    firstPage << pages.first() << used.first();
+    foreach(int object, firstPage) {
+        assigned.insert(object);
+    }
+
+    // Remaining pages own the objects only they use, objects used by several
+    // pages go into the shared section unless the first page has them
+    QList<QList<int> > groups;
+    QList<QList<int> > pageShared;
+    QList<int> shared;
+    for(int i = 1; i < pages.size(); ++i) {
+        QList<int> group;
+        QList<int> sharedObjects;
+        group << pages.at(i);
+        assigned.insert(pages.at(i));
+        foreach(int object, used.at(i)) {
+            if(usage.value(object) > 1) {
+                sharedObjects << object;
+                if(!assigned.contains(object)) {
+                    shared << object;
+                    assigned.insert(object);
+                }
+            } else {
+                group << object;
+                assigned.insert(object);
+            }
+        }
+        groups << group;
+        pageShared << sharedObjects;
+    }
+
+    // Document level objects such as the info dictionary and outlines
+    const int catalog = document.root();
+    const QByteArray catalogBody = document.object(catalog);
+    const int oldPagesRoot = PdfDocument::reference(catalogBody, "/Pages");
+    QList<int> roots;
+    foreach(const PdfDocument::Reference &reference, PdfDocument::references(catalogBody)) {
+        if(reference.key != "/Pages")
+            roots << reference.number;
+    }
+    if(document.info() >= 0)
+        roots << document.info();
+    QList<int> others;
+    foreach(int root, roots) {
+        foreach(int object, QList<int>() << root << reachable(root)) {
+            if(!assigned.contains(object) && !pageSet.contains(object)) {
+                others << object;
+                assigned.insert(object);
+            }
+        }
+    }
+
+    // The first page section is numbered last so that both cross-reference
+    // sections are contiguous
+    int next = 1;
+    foreach(const QList<int> &group, groups) {
+        foreach(int object, group) {
+            numbers.insert(object, next++);
+        }
+    }
+    foreach(int object, shared) {
+        numbers.insert(object, next++);
+    }
+    pagesRoot = next++;
+    foreach(int object, others) {
+        numbers.insert(object, next++);
+    }
+    firstPageNumber = next;
+    const int catalogNumber = next + 1;
+    const int hintNumber = next + 2;
+    next += 3;
+    foreach(int object, firstPage) {
+        numbers.insert(object, next++);
+    }
+    objectCount = next;
+    if(oldPagesRoot >= 0 && !numbers.contains(oldPagesRoot))
+        numbers.insert(oldPagesRoot, pagesRoot);
+
+    Entry catalogEntry;
+    catalogEntry.number = catalogNumber;
+    catalogEntry.body = PdfDocument::renumbered(catalogBody, numbers);
+    catalogEntry.size = objectText(catalogEntry).size();
+
+    Entry pagesEntry;
+    pagesEntry.number = pagesRoot;
+    pagesEntry.body = "<<\n/Type /Pages\n/Kids [";
+    foreach(int page, pages) {
+        pagesEntry.body += QByteArray::number(numbers.value(page)) + " 0 R ";
+    }
+    pagesEntry.body += "]\n/Count " + QByteArray::number(pages.size()) + "\n>>\n";
+    pagesEntry.size = objectText(pagesEntry).size();
+
+    QList<Entry> firstPageEntries;
+    foreach(int object, firstPage) {
+        firstPageEntries << entry(object);
+    }
+    QList<QList<Entry> > groupEntries;
+    foreach(const QList<int> &group, groups) {
+        QList<Entry> entries;
+        foreach(int object, group) {
+            entries << entry(object);
+        }
+        groupEntries << entries;
+    }
+    QList<Entry> sharedEntries;
+    foreach(int object, shared) {
+        sharedEntries << entry(object);
+    }
+    QList<Entry> otherEntries;
+    otherEntries << pagesEntry;
+    foreach(int object, others) {
+        otherEntries << entry(object);
+    }
+
+    // Shared object hint table entries, one per object. The first page
+    // objects come first followed by the shared section.
+    QHash<int, int> sharedIdentifiers;
+    for(int i = 0; i < firstPage.size(); ++i) {
+        sharedIdentifiers.insert(firstPage.at(i), i);
+    }
+    for(int i = 0; i < shared.size(); ++i) {
+        sharedIdentifiers.insert(shared.at(i), firstPage.size() + i);
+    }
+    QList<QList<int> > pageSharedIdentifiers;
+    foreach(const QList<int> &objects, pageShared) {
+        QList<int> identifiers;
+        foreach(int object, objects) {
+            identifiers << sharedIdentifiers.value(object);
+        }
+        pageSharedIdentifiers << identifiers;
+    }
+
+    const QByteArray header = "%PDF-" + document.version() + "\n%\xE2\xE3\xCF\xD3\n";
+    const qint64 linearizationSize = linearizationDictionary(0, 0, 0, 0, 0).size();
+    const qint64 firstXrefSize = firstPageCrossReference(QVector<qint64>(objectCount, 0), 0).size();
+
+    struct Layout
+    {
+        QVector<qint64> offsets;
+        qint64 firstXref;
+        qint64 firstPageEnd;
+        qint64 sharedOffset;
+        qint64 mainXref;
+        qint64 mainXrefEntries;
+        qint64 fileSize;
+    };
+    auto layout = [&](qint64 hintSize) {
+        Layout result;
+        result.offsets = QVector<qint64>(objectCount, 0);
+        qint64 position = header.size();
+        result.offsets[firstPageNumber] = position;
+        position += linearizationSize;
+        result.firstXref = position;
+        position += firstXrefSize;
+        result.offsets[catalogNumber] = position;
+        position += catalogEntry.size;
+        result.offsets[hintNumber] = position;
+        position += hintSize;
+        foreach(const Entry &entry, firstPageEntries) {
+            result.offsets[entry.number] = position;
+            position += entry.size;
+        }
+        result.firstPageEnd = position;
+        foreach(const QList<Entry> &entries, groupEntries) {
+            foreach(const Entry &entry, entries) {
+                result.offsets[entry.number] = position;
+                position += entry.size;
+            }
+        }
+        result.sharedOffset = sharedEntries.isEmpty() ? 0 : position;
+        foreach(const Entry &entry, sharedEntries + otherEntries) {
+            result.offsets[entry.number] = position;
+            position += entry.size;
+        }
+        result.mainXref = position;
+        // The offset of the end of line before the first entry
+        result.mainXrefEntries = position + QByteArray("xref\n0 " + QByteArray::number(firstPageNumber) + "\n").size() - 1;
+        position += mainCrossReference(result.offsets, result.firstXref).size();
+        result.fileSize = position;
+        return result;
+    };
+
+    // Offsets in the hint tables are given as if the hint stream wasn't there
+    const Layout withoutHints = layout(0);
+    QByteArray hints = hintStream(firstPageEntries, groupEntries, pageSharedIdentifiers, sharedEntries,
+                                  withoutHints.offsets.at(numbers.value(pages.first())), withoutHints.sharedOffset);
+    hints = QByteArray::number(hintNumber) + " 0 obj\n" + hints + "endobj\n";
+    const Layout withHints = layout(hints.size());
+
+    QFile file(output);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        error = file.errorString();
+        return false;
+    }
+    file.write(header);
+    file.write(linearizationDictionary(withHints.fileSize, withHints.offsets.at(hintNumber), hints.size(),
+                                       withHints.firstPageEnd, withHints.mainXrefEntries));
+    file.write(firstPageCrossReference(withHints.offsets, withHints.mainXref));
+    file.write(objectText(catalogEntry));
+    file.write(hints);
+    foreach(const Entry &entry, firstPageEntries) {
+        file.write(objectText(entry));
+    }
+    foreach(const QList<Entry> &entries, groupEntries) {
+        foreach(const Entry &entry, entries) {
+            file.write(objectText(entry));
+        }
+    }
+    foreach(const Entry &entry, sharedEntries + otherEntries) {
+        file.write(objectText(entry));
+    }
+    file.write(mainCrossReference(withHints.offsets, withHints.firstXref));
+
+    if(file.error() != QFile::NoError) {
+        error = file.errorString();
+        return false;
+    }
+    if(file.pos() != withHints.fileSize) {
+        error = "The linearized layout doesn't match the written file";
+        return false;
+    }
+    document.close();
+    return true;
+}
+
+QList<int> PdfLinearizer::reachable(int object) const
+{
+    QList<int> result;
+    QSet<int> visited;
+    visited.insert(object);
+    QList<int> stack;
+    stack << object;
+    while(!stack.isEmpty()) {
+        const int current = stack.takeLast();
+        const QByteArray body = document.object(current);
+        const bool page = pageSet.contains(current);
+        foreach(const PdfDocument::Reference &reference, PdfDocument::references(body)) {
+            if(page && reference.key == "/Parent")
+                continue;
+            if(pageSet.contains(reference.number))
+                continue;
+            if(visited.contains(reference.number))
+                continue;
+            visited.insert(reference.number);
+            result << reference.number;
+            stack << reference.number;
+        }
+    }
+    return result;
+}
+
+PdfLinearizer::Entry PdfLinearizer::entry(int source)
+{
+    Entry result;
+    result.number = numbers.value(source);
+    result.source = source;
+    result.size = objectText(result).size();
+    return result;
+}
+
+QByteArray PdfLinearizer::objectText(const Entry &entry) const
+{
+    QByteArray text = QByteArray::number(entry.number) + " 0 obj\n" + bodyOf(entry);
+    if(!text.endsWith('\n'))
+        text += '\n';
+    text += "endobj\n";
+    return text;
+}
+
+QByteArray PdfLinearizer::bodyOf(const Entry &entry) const
+{
+    if(entry.source < 0)
+        return entry.body;
+
+    QByteArray body = document.object(entry.source);
+    if(body.isEmpty())
+        return "null";
+    if(!pageSet.contains(entry.source))
+        return PdfDocument::renumbered(body, numbers);
+
+    // Pages are moved under the new page tree
+    return PdfDocument::renumbered(document.flattenedPage(entry.source), numbers, pagesRoot);
+}
+
+QByteArray PdfLinearizer::linearizationDictionary(qint64 fileSize, qint64 hintOffset, qint64 hintSize, qint64 firstPageEnd, qint64 mainXrefEntries) const
+{
+    return QByteArray::number(firstPageNumber) + " 0 obj\n"
+            + "<< /Linearized 1 /L " + fixedWidth(fileSize)
+            + " /H [ " + fixedWidth(hintOffset) + " " + fixedWidth(hintSize) + " ]"
+            + " /O " + QByteArray::number(numbers.value(pages.first()))
+            + " /E " + fixedWidth(firstPageEnd)
+            + " /N " + QByteArray::number(pages.size())
+            + " /T " + fixedWidth(mainXrefEntries) + " >>\nendobj\n";
+}
+
+QByteArray PdfLinearizer::firstPageCrossReference(const QVector<qint64> &offsets, qint64 mainXrefOffset) const
+{
+    QByteArray result = "xref\n" + QByteArray::number(firstPageNumber) + " "
+            + QByteArray::number(objectCount - firstPageNumber) + "\n";
+    for(int i = firstPageNumber; i < objectCount; ++i) {
+        result += crossReferenceEntry(offsets.at(i));
+    }
+
+    const QByteArray trailer = document.trailer();
+    result += "trailer\n<< /Size " + QByteArray::number(objectCount)
+            + " /Root " + QByteArray::number(firstPageNumber + 1) + " 0 R";
+    if(document.info() >= 0 && numbers.contains(document.info()))
+        result += " /Info " + QByteArray::number(numbers.value(document.info())) + " 0 R";
+    const QByteArray id = PdfDocument::value(trailer, "/ID");
+    if(!id.isEmpty())
+        result += " /ID " + id;
+    result += " /Prev " + fixedWidth(mainXrefOffset) + " >>\nstartxref\n0\n%%EOF\n";
+    return result;
+}
+
+QByteArray PdfLinearizer::mainCrossReference(const QVector<qint64> &offsets, qint64 firstXrefOffset) const
+{
+    QByteArray result = "xref\n0 " + QByteArray::number(firstPageNumber) + "\n";
+    result += "0000000000 65535 f \n";
+    for(int i = 1; i < firstPageNumber; ++i) {
+        result += crossReferenceEntry(offsets.at(i));
+    }
+    result += "trailer\n<< /Size " + QByteArray::number(firstPageNumber) + " >>\n";
+    result += "startxref\n" + QByteArray::number(firstXrefOffset) + "\n%%EOF\n";
+    return result;
+}
+
+QByteArray PdfLinearizer::hintStream(const QList<Entry> &firstPage, const QList<QList<Entry> > &pageGroups,
+                                     const QList<QList<int> > &pageShared, const QList<Entry> &shared,
+                                     qint64 firstPageOffset, qint64 sharedOffset) const
+{
+    // Page offset hint table, the first page has no shared object references
+    // as everything it needs is in the first page section
+    QList<qint64> objectCounts;
+    QList<qint64> lengths;
+    QList<QList<int> > references;
+    qint64 firstPageLength = 0;
+    foreach(const Entry &entry, firstPage) {
+        firstPageLength += entry.size;
+    }
+    objectCounts << firstPage.size();
+    lengths << firstPageLength;
+    references << QList<int>();
+    for(int i = 0; i < pageGroups.size(); ++i) {
+        qint64 length = 0;
+        foreach(const Entry &entry, pageGroups.at(i)) {
+            length += entry.size;
+        }
+        objectCounts << pageGroups.at(i).size();
+        lengths << length;
+        references << pageShared.at(i);
+    }
+
+    qint64 leastObjects = objectCounts.first();
+    qint64 mostObjects = leastObjects;
+    qint64 leastLength = lengths.first();
+    qint64 mostLength = leastLength;
+    int mostReferences = 0;
+    int greatestIdentifier = 0;
+    for(int i = 0; i < objectCounts.size(); ++i) {
+        leastObjects = qMin(leastObjects, objectCounts.at(i));
+        mostObjects = qMax(mostObjects, objectCounts.at(i));
+        leastLength = qMin(leastLength, lengths.at(i));
+        mostLength = qMax(mostLength, lengths.at(i));
+        mostReferences = qMax(mostReferences, references.at(i).size());
+        foreach(int identifier, references.at(i)) {
+            greatestIdentifier = qMax(greatestIdentifier, identifier);
+        }
+    }
+    const int objectBits = bitsNeeded(mostObjects - leastObjects);
+    const int lengthBits = bitsNeeded(mostLength - leastLength);
+    const int referenceBits = bitsNeeded(mostReferences);
+    const int identifierBits = bitsNeeded(greatestIdentifier);
+
+    BitWriter table;
+    table.write(leastObjects, 32);
+    table.write(firstPageOffset, 32);
+    table.write(objectBits, 16);
+    table.write(leastLength, 32);
+    table.write(lengthBits, 16);
+    // Content stream offsets and lengths are left out
+    table.write(0, 32);
+    table.write(0, 16);
+    table.write(0, 32);
+    table.write(0, 16);
+    table.write(referenceBits, 16);
+    table.write(identifierBits, 16);
+    // Shared objects are always whole objects, no fractions needed
+    table.write(0, 16);
+    table.write(0, 16);
+
+    foreach(qint64 count, objectCounts) {
+        table.write(count - leastObjects, objectBits);
+    }
+    table.flush();
+    foreach(qint64 length, lengths) {
+        table.write(length - leastLength, lengthBits);
+    }
+    table.flush();
+    foreach(const QList<int> &identifiers, references) {
+        table.write(identifiers.size(), referenceBits);
+    }
+    table.flush();
+    foreach(const QList<int> &identifiers, references) {
+        foreach(int identifier, identifiers) {
+            table.write(identifier, identifierBits);
+        }
+    }
+    table.flush();
+
+    // Shared object hint table with one group per object
+    const int sharedTableOffset = table.data.size();
+    const QList<Entry> groups = firstPage + shared;
+    qint64 leastGroup = groups.first().size;
+    qint64 mostGroup = leastGroup;
+    foreach(const Entry &entry, groups) {
+        leastGroup = qMin(leastGroup, entry.size);
+        mostGroup = qMax(mostGroup, entry.size);
+    }
+    const int groupBits = bitsNeeded(mostGroup - leastGroup);
+
+    table.write(shared.isEmpty() ? 0 : shared.first().number, 32);
+    table.write(sharedOffset, 32);
+    table.write(firstPage.size(), 32);
+    table.write(groups.size(), 32);
+    table.write(0, 16);
+    table.write(leastGroup, 32);
+    table.write(groupBits, 16);
+    foreach(const Entry &entry, groups) {
+        table.write(entry.size - leastGroup, groupBits);
+    }
+    table.flush();
+    // No MD5 signatures
+    foreach(const Entry &entry, groups) {
+        Q_UNUSED(entry)
+        table.write(0, 1);
+    }
+    table.flush();
+
+    return "<<\n/Length " + QByteArray::number(table.data.size())
+            + "\n/S " + QByteArray::number(sharedTableOffset) + "\n>>\nstream\n"
+            + table.data + "\nendstream\n";
+}
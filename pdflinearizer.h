@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef PDFLINEARIZER_H
+#define PDFLINEARIZER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include "pdfdocument.h"
+
+// Rewrites a PDF written by QPrinter as a linearized ("fast web view") file.
+// Everything the first page needs is written right after the linearization
+// dictionary and the primary hint stream, followed by the remaining pages in
+// order, the objects they share and finally everything else. A viewer reading
+// the file over a slow connection can show the first page as soon as it has
+// arrived.
+class PdfLinearizer
+{
+public:
+    PdfLinearizer();
+
+    bool linearize(const QString &input, const QString &output);
+    QString errorString() const;
+private:
+    // Object in the order it's written to the output file
+    struct Entry
+    {
+        Entry() : number(0), source(-1), size(0) { }
+
+        int number;
+        // Object in the input file, -1 for objects created here
+        int source;
+        QByteArray body;
+        qint64 size;
+    };
+
+    // Objects referenced directly or indirectly, other pages are not followed
+    QList<int> reachable(int object) const;
+    Entry entry(int source);
+    QByteArray objectText(const Entry &entry) const;
+    QByteArray bodyOf(const Entry &entry) const;
+
+    QByteArray linearizationDictionary(qint64 fileSize, qint64 hintOffset, qint64 hintSize, qint64 firstPageEnd, qint64 mainXrefEntries) const;
+    QByteArray firstPageCrossReference(const QVector<qint64> &offsets, qint64 mainXrefOffset) const;
+    QByteArray mainCrossReference(const QVector<qint64> &offsets, qint64 firstXrefOffset) const;
+    QByteArray hintStream(const QList<Entry> &firstPage, const QList<QList<Entry> > &pageGroups,
+                          const QList<QList<int> > &pageShared, const QList<Entry> &shared,
+                          qint64 firstPageOffset, qint64 sharedOffset) const;
+
+    PdfDocument document;
+    QString error;
+    QList<int> pages;
+    QSet<int> pageSet;
+    QHash<int, int> numbers;
+    int pagesRoot;
+    // First object number of the first page section
+    int firstPageNumber;
+    int objectCount;
+};
+
+#endif // PDFLINEARIZER_H
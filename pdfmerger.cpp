@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "pdfmerger.h"
+#include "pdfdocument.h"
+
+#include <QCryptographicHash>
+
+namespace {
+
+QByteArray headerVersion(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    const QByteArray header = file.read(8);
+    if(!header.startsWith("%PDF-"))
+        return QByteArray();
+    return header.mid(5, 3);
+}
+
+}
+
+PdfMerger::PdfMerger()
+    : pagesObject(0), shared(0)
+{
+}
+
+void PdfMerger::addFile(const QString &fileName)
+{
+    files << fileName;
+}
+
+QString PdfMerger::errorString() const
+{
+    return error;
+}
+
+bool PdfMerger::merge(const QString &location)
+{
+    error.clear();
+    offsets.clear();
+    offsets << -1;
+    written.clear();
+    shared = 0;
+
+    QByteArray version("1.4");
+    foreach(const QString &fileName, files) {
+        const QByteArray partVersion = headerVersion(fileName);
+        if(partVersion.isEmpty()) {
+            error = QString("%1 is not a PDF file").arg(fileName);
+            return false;
+        }
+        version = qMax(version, partVersion);
+    }
+
+    output.setFileName(location);
+    if(!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        error = output.errorString();
+        return false;
+    }
+    // The binary comment marks the file as binary for transfer programs
+    output.write("%PDF-" + version + "\n%\xE2\xE3\xCF\xD3\n");
+
+    pagesObject = reserveObject();
+    QList<int> kids;
+    int infoObject = -1;
+
+    foreach(const QString &fileName, files) {
+        PdfDocument document;
+        if(!document.open(fileName)) {
+            error = QString("Unable to read %1").arg(fileName);
+            output.close();
+            return false;
+        }
+
+        Part part;
+        part.document = &document;
+        foreach(int page, document.pages()) {
+            kids << copyObject(part, page);
+        }
+        if(infoObject < 0 && document.info() >= 0)
+            infoObject = copyObject(part, document.info());
+        if(!error.isEmpty()) {
+            output.close();
+            return false;
+        }
+    }
+
+    QByteArray pages("<<\n/Type /Pages\n/Kids [");
+    foreach(int kid, kids) {
+        pages += QByteArray::number(kid) + " 0 R ";
+    }
+    pages += "]\n/Count " + QByteArray::number(kids.size()) + "\n>>\n";
+    writeObject(pagesObject, pages);
+
+    const int catalog = reserveObject();
+    writeObject(catalog, "<<\n/Type /Catalog\n/Pages " + QByteArray::number(pagesObject) + " 0 R\n>>\n");
+
+    const qint64 xref = output.pos();
+    QByteArray table("xref\n0 " + QByteArray::number(offsets.size()) + "\n");
+    table += "0000000000 65535 f \n";
+    for(int i = 1; i < offsets.size(); ++i) {
+        if(offsets.at(i) < 0)
+            table += "0000000000 00000 f \n";
+        else
+            table += QByteArray::number(offsets.at(i)).rightJustified(10, '0') + " 00000 n \n";
+    }
+    table += "trailer\n<<\n/Size " + QByteArray::number(offsets.size()) + "\n";
+    if(infoObject >= 0)
+        table += "/Info " + QByteArray::number(infoObject) + " 0 R\n";
+    table += "/Root " + QByteArray::number(catalog) + " 0 R\n>>\n";
+    table += "startxref\n" + QByteArray::number(xref) + "\n%%EOF\n";
+    if(output.write(table) != table.size())
+        error = output.errorString();
+
+    output.close();
+    return error.isEmpty();
+}
+
+int PdfMerger::copyObject(Part &part, int number)
+{
+    const QHash<int, int>::const_iterator existing = part.numbers.constFind(number);
+    if(existing != part.numbers.constEnd())
+        return existing.value();
+
+    // A reference back to an object which is still being copied, it gets
+    // this number once it's written
+    if(part.visiting.contains(number)) {
+        const int reserved = reserveObject();
+        part.numbers.insert(number, reserved);
+        return reserved;
+    }
+
+    QByteArray body = part.document->object(number);
+    // References to missing objects are treated as null
+    if(body.isEmpty())
+        body = "null";
+
+    // Pages are never shared and their parent is the merged page tree
+    const bool page = PdfDocument::value(body, "/Type").trimmed() == "/Page";
+    if(page)
+        body = part.document->flattenedPage(number);
+
+    part.visiting.insert(number);
+    QHash<int, int> numbers;
+    foreach(const PdfDocument::Reference &reference, PdfDocument::references(body)) {
+        if(page && reference.key == "/Parent")
+            numbers.insert(reference.number, pagesObject);
+        else if(!numbers.contains(reference.number))
+            numbers.insert(reference.number, copyObject(part, reference.number));
+    }
+    body = PdfDocument::renumbered(body, numbers);
+    part.visiting.remove(number);
+
+    const QHash<int, int>::const_iterator reserved = part.numbers.constFind(number);
+    if(reserved != part.numbers.constEnd()) {
+        writeObject(reserved.value(), body);
+        return reserved.value();
+    }
+
+    QByteArray hash;
+    if(!page) {
+        hash = QCryptographicHash::hash(body, QCryptographicHash::Sha1);
+        const QHash<QByteArray, int>::const_iterator identical = written.constFind(hash);
+        if(identical != written.constEnd()) {
+            ++shared;
+            part.numbers.insert(number, identical.value());
+            return identical.value();
+        }
+    }
+
+    const int result = reserveObject();
+    writeObject(result, body);
+    if(!page)
+        written.insert(hash, result);
+    part.numbers.insert(number, result);
+    return result;
+}
+
+int PdfMerger::reserveObject()
+{
+    offsets << -1;
+    return offsets.size() - 1;
+}
+
+bool PdfMerger::writeObject(int number, const QByteArray &body)
+{
+    offsets[number] = output.pos();
+    QByteArray object = QByteArray::number(number) + " 0 obj\n" + body;
+    if(!object.endsWith('\n'))
+        object += '\n';
+    object += "endobj\n";
+    if(output.write(object) != object.size()) {
+        error = output.errorString();
+        return false;
+    }
+    return true;
+}
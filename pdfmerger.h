@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef PDFMERGER_H
+#define PDFMERGER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+class PdfDocument;
+
+// Concatenates the pages of PDF files written by QPrinter into one document.
+//
+// Objects are copied starting from the pages so anything unreachable from
+// them is dropped. Objects whose content is identical after renumbering are
+// written once, which shares images and fonts that are byte for byte the same
+// in several parts. Fonts are only shared when each part embedded the same
+// glyph subset.
+class PdfMerger
+{
+public:
+    PdfMerger();
+
+    void addFile(const QString &fileName);
+    bool merge(const QString &location);
+
+    QString errorString() const;
+    // Objects which were replaced by an identical earlier object
+    int sharedObjects() const { return shared; }
+private:
+    struct Part
+    {
+        PdfDocument *document;
+        // Source object number to output object number
+        QHash<int, int> numbers;
+        QSet<int> visiting;
+    };
+
+    int copyObject(Part &part, int number);
+    int reserveObject();
+    bool writeObject(int number, const QByteArray &body);
+
+    QStringList files;
+    QString error;
+    QFile output;
+    // Output offsets indexed by object number, number 0 is never used
+    QVector<qint64> offsets;
+    QHash<QByteArray, int> written;
+    int pagesObject;
+    int shared;
+};
+
+#endif // PDFMERGER_H
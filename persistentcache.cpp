@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "persistentcache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QVector>
+
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// "QPC1" in the byte order of the machine which wrote the file
+const quint32 magicNumber = 0x51504331;
+// Bumped whenever the layout of an entry changes. The Qt version is part of
+// it as the image formats stored in the entries follow Qt.
+const quint32 formatVersion = (1u << 24) | QT_VERSION;
+
+// Leading fields of an image entry, followed by the colour table and the
+// scan lines
+struct ImageHeader
+{
+    qint32 width;
+    qint32 height;
+    qint32 format;
+    qint32 bytesPerLine;
+    qint32 colorCount;
+    qint32 dotsPerMeterX;
+    qint32 dotsPerMeterY;
+};
+
+}
+
+PersistentCache::PersistentCache() :
+    maxSize(256 * 1024 * 1024),
+    directorySize(0)
+{
+}
+
+bool PersistentCache::setDirectory(const QString &directory)
+{
+    path.clear();
+    if(directory.isEmpty())
+        return true;
+
+    if(!QDir().mkpath(directory))
+        return false;
+    path = QDir(directory).absolutePath();
+    prune();
+    return true;
+}
+
+QString PersistentCache::directory() const
+{
+    return path;
+}
+
+bool PersistentCache::isEnabled() const
+{
+    return !path.isEmpty();
+}
+
+void PersistentCache::setMaxSize(qint64 bytes)
+{
+    maxSize = bytes;
+    if(isEnabled())
+        prune();
+}
+
+qint64 PersistentCache::maximumSize() const
+{
+    return maxSize;
+}
+
+QImage PersistentCache::image(const QByteArray &key) const
+{
+    QFile file(fileName(key, ImageEntry));
+    qint64 size = 0;
+    const uchar *data = map(file, ImageEntry, size);
+    if(data == nullptr || size < qint64(sizeof(ImageHeader)))
+        return QImage();
+
+    ImageHeader header;
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    size -= sizeof(header);
+
+    if(header.width <= 0 || header.height <= 0 || header.colorCount < 0
+            || header.format <= QImage::Format_Invalid || header.format >= QImage::NImageFormats)
+        return QImage();
+    const qint64 tableBytes = qint64(header.colorCount) * sizeof(QRgb);
+    if(size != tableBytes + qint64(header.bytesPerLine) * header.height)
+        return QImage();
+
+    QImage image(header.width, header.height, QImage::Format(header.format));
+    if(image.isNull() || image.bytesPerLine() != header.bytesPerLine)
+        return QImage();
+
+    if(header.colorCount > 0) {
+        QVector<QRgb> colorTable(header.colorCount);
+        memcpy(colorTable.data(), data, tableBytes);
+        image.setColorTable(colorTable);
+        data += tableBytes;
+    }
+    // A single copy out of the mapping, still much cheaper than decoding
+    memcpy(image.bits(), data, size_t(header.bytesPerLine) * header.height);
+    image.setDotsPerMeterX(header.dotsPerMeterX);
+    image.setDotsPerMeterY(header.dotsPerMeterY);
+    return image;
+}
+
+void PersistentCache::insertImage(const QByteArray &key, const QImage &image)
+{
+    if(!isEnabled() || image.isNull())
+        return;
+
+    ImageHeader header;
+    header.width = image.width();
+    header.height = image.height();
+    header.format = image.format();
+    header.bytesPerLine = image.bytesPerLine();
+    header.colorCount = image.colorCount();
+    header.dotsPerMeterX = image.dotsPerMeterX();
+    header.dotsPerMeterY = image.dotsPerMeterY();
+
+    const QVector<QRgb> colorTable = image.colorTable();
+    const qint64 pixelBytes = qint64(image.bytesPerLine()) * image.height();
+    QByteArray payload;
+    payload.reserve(int(sizeof(header) + colorTable.size() * sizeof(QRgb) + pixelBytes));
+    payload.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    payload.append(reinterpret_cast<const char*>(colorTable.constData()), colorTable.size() * int(sizeof(QRgb)));
+    payload.append(reinterpret_cast<const char*>(image.constBits()), int(pixelBytes));
+    write(key, ImageEntry, payload);
+}
+
+QByteArray PersistentCache::fileHash(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    // Resources which are compressed can't be mapped
+    if(const uchar *data = file.map(0, file.size())) {
+        hash.addData(reinterpret_cast<const char*>(data), int(qMin<qint64>(file.size(), INT_MAX)));
+    } else if(!hash.addData(&file)) {
+        return QByteArray();
+    }
+    return hash.result();
+}
+
+QString PersistentCache::fileName(const QByteArray &key, Kind kind) const
+{
+    if(!isEnabled())
+        return QString();
+    Q_UNUSED(kind);
+    return path + QLatin1Char('/') + QString::fromLatin1(key.toHex()) + QStringLiteral(".image");
+}
+
+const uchar *PersistentCache::map(QFile &file, Kind kind, qint64 &size) const
+{
+    if(file.fileName().isEmpty() || !file.open(QIODevice::ReadOnly))
+        return nullptr;
+    if(file.size() < qint64(sizeof(Header)))
+        return nullptr;
+
+    const uchar *data = file.map(0, file.size());
+    if(data == nullptr)
+        return nullptr;
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    if(header.magic != magicNumber || header.version != formatVersion || header.kind != quint32(kind))
+        return nullptr;
+    // Truncated by a crash or a full disk
+    if(header.size != file.size() - qint64(sizeof(header)))
+        return nullptr;
+
+    size = header.size;
+    return data + sizeof(header);
+}
+
+void PersistentCache::write(const QByteArray &key, Kind kind, const QByteArray &payload)
+{
+    Header header;
+    header.magic = magicNumber;
+    header.version = formatVersion;
+    header.kind = kind;
+    header.reserved = 0;
+    header.size = payload.size();
+
+    // The entry only appears under its name once it has been written
+    // completely, readers in other processes never see half of it
+    QSaveFile file(fileName(key, kind));
+    if(!file.open(QIODevice::WriteOnly))
+        return;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(payload);
+    if(!file.commit())
+        return;
+
+    // Other processes write into the same directory, prune() counts the
+    // files again rather than trusting this
+    directorySize += qint64(sizeof(header)) + payload.size();
+    if(maxSize > 0 && directorySize > maxSize)
+        prune();
+}
+
+void PersistentCache::prune()
+{
+    if(maxSize <= 0)
+        return;
+
+    // Pictures are left over from versions which kept recorded forms here
+    const QFileInfoList entries = QDir(path).entryInfoList(QStringList() << "*.image" << "*.picture",
+                                                           QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    foreach(const QFileInfo &entry, entries)
+        total += entry.size();
+
+    // Oldest entries first. Once over the limit the directory is trimmed a
+    // bit further so that the following writes don't list it every time.
+    const qint64 target = total > maxSize ? maxSize - maxSize / 10 : maxSize;
+    foreach(const QFileInfo &entry, entries) {
+        if(total <= target)
+            break;
+        if(QFile::remove(entry.absoluteFilePath()))
+            total -= entry.size();
+    }
+    directorySize = total;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef PERSISTENTCACHE_H
+#define PERSISTENTCACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QImage>
+#include <QString>
+
+// Cache directory kept across processes so that jobs after a restart don't
+// decode the same images again.
+//
+// Every entry is a file of its own named after its key, a hash of the content
+// and the options it was produced with. Files start with a header holding a
+// magic number, the format version and the kind of entry, anything written by
+// another version or on a machine of different byte order is ignored and
+// overwritten. Entries are read through QFile::map and written through
+// QSaveFile so several processes can share the directory.
+class PersistentCache
+{
+public:
+    PersistentCache();
+
+    // An empty path disables the cache. The oldest entries are removed when
+    // the directory grows larger than the maximum size, checked when it's
+    // set and whenever the entries written since cross the limit.
+    bool setDirectory(const QString &path);
+    QString directory() const;
+    bool isEnabled() const;
+    void setMaxSize(qint64 bytes);
+    qint64 maximumSize() const;
+
+    // Returns a null image when the entry is missing
+    QImage image(const QByteArray &key) const;
+    void insertImage(const QByteArray &key, const QImage &image);
+
+    // Hash of a file's content, empty if the file can't be read
+    static QByteArray fileHash(const QString &fileName);
+private:
+    enum Kind
+    {
+        ImageEntry = 1
+    };
+
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 kind;
+        quint32 reserved;
+        qint64 size;
+    };
+
+    QString fileName(const QByteArray &key, Kind kind) const;
+    // Maps the entry and returns its payload, which stays valid while the
+    // file is open
+    const uchar *map(QFile &file, Kind kind, qint64 &size) const;
+    void write(const QByteArray &key, Kind kind, const QByteArray &payload);
+    void prune();
+
+    QString path;
+    qint64 maxSize;
+    // Size of the directory at the last prune plus everything written since
+    qint64 directorySize;
+};
+
+#endif // PERSISTENTCACHE_H
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "printpreview.h"
+#include "cachecost.h"
+#include "qmlprinter.h"
+
+#include <QPainter>
+#include <QtConcurrent>
+#include <QtMath>
+
+namespace {
+
+QImage renderPage(const DisplayList &page, const QSize &size, qreal zoom)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
+    painter.scale(zoom, zoom);
+    page.replay(&painter);
+    painter.end();
+    return image;
+}
+
+}
+
+PrintPreview::PrintPreview(QmlPrinter *printer, QObject *parent) :
+    QAbstractListModel(parent),
+    printer(printer),
+    currentZoom(1.0),
+    firstVisible(0),
+    lastVisible(0),
+    prefetch(2),
+    recordings(64),
+    oversizedPage(-1),
+    generation(0),
+    renderingPage(-1),
+    renderingGeneration(-1)
+{
+    setCacheSize(128 * 1024 * 1024);
+    connect(&watcher, SIGNAL(finished()), this, SLOT(renderFinished()));
+}
+
+PrintPreview::~PrintPreview()
+{
+    watcher.waitForFinished();
+}
+
+void PrintPreview::setPages(const QList<QQuickItem *> &pages)
+{
+    beginResetModel();
+    this->pages = pages;
+    ++generation;
+    recordings.clear();
+    images.clear();
+    requested.clear();
+    oversizedPage = -1;
+    oversizedImage = QImage();
+    firstVisible = 0;
+    lastVisible = 0;
+    endResetModel();
+}
+
+void PrintPreview::setZoom(qreal zoom)
+{
+    if(qFuzzyCompare(zoom, currentZoom) || zoom <= 0)
+        return;
+    currentZoom = zoom;
+    ++generation;
+    // The display lists stay valid, only the images depend on the zoom
+    images.clear();
+    requested.clear();
+    oversizedPage = -1;
+    oversizedImage = QImage();
+    if(!pages.isEmpty())
+        emit dataChanged(index(0), index(pages.size() - 1));
+    scheduleRender();
+}
+
+qreal PrintPreview::zoom() const
+{
+    return currentZoom;
+}
+
+void PrintPreview::setVisiblePages(int first, int last)
+{
+    firstVisible = qMax(0, first);
+    lastVisible = qMin(last, pages.size() - 1);
+    // Requests for pages which were scrolled past are dropped
+    QList<int> stillWanted;
+    foreach(int page, requested) {
+        if(page >= firstVisible - prefetch && page <= lastVisible + prefetch)
+            stillWanted << page;
+    }
+    requested = stillWanted;
+    scheduleRender();
+}
+
+void PrintPreview::setPrefetch(int pages)
+{
+    prefetch = qMax(0, pages);
+}
+
+void PrintPreview::setCacheSize(qint64 bytes)
+{
+    images.setMaxCost(maxCacheCost(bytes));
+}
+
+QImage PrintPreview::pageImage(int index)
+{
+    if(index < 0 || index >= pages.size())
+        return QImage();
+    if(QImage *image = images.object(index))
+        return *image;
+    if(index == oversizedPage)
+        return oversizedImage;
+    requestPage(index);
+    return QImage();
+}
+
+int PrintPreview::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return pages.size();
+}
+
+QVariant PrintPreview::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() >= pages.size())
+        return QVariant();
+
+    switch(role) {
+    case ImageRole:
+        // Asking for an image is what triggers rendering it
+        return const_cast<PrintPreview*>(this)->pageImage(index.row());
+    case SizeRole:
+        return imageSize(index.row());
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> PrintPreview::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles.insert(ImageRole, "image");
+    roles.insert(SizeRole, "size");
+    return roles;
+}
+
+void PrintPreview::requestPage(int index)
+{
+    if(index == renderingPage && renderingGeneration == generation)
+        return;
+    if(!requested.contains(index))
+        requested << index;
+    scheduleRender();
+}
+
+void PrintPreview::scheduleRender()
+{
+    if(watcher.isRunning() || pages.isEmpty())
+        return;
+
+    // Visible pages come first, then the closest neighbours
+    int next = -1;
+    for(int page = firstVisible; page <= lastVisible && next < 0; ++page) {
+        if(!isRendered(page))
+            next = page;
+    }
+    foreach(int page, requested) {
+        if(next >= 0)
+            break;
+        if(!isRendered(page))
+            next = page;
+    }
+    for(int distance = 1; distance <= prefetch && next < 0; ++distance) {
+        if(lastVisible + distance < pages.size() && !isRendered(lastVisible + distance))
+            next = lastVisible + distance;
+        else if(firstVisible - distance >= 0 && !isRendered(firstVisible - distance))
+            next = firstVisible - distance;
+    }
+    if(next < 0)
+        return;
+    requested.removeAll(next);
+
+    DisplayList *recording = pageRecording(next);
+    if(recording == nullptr)
+        return;
+
+    renderingPage = next;
+    renderingGeneration = generation;
+    // Painting fills caches inside the paths, the worker gets a copy of its own
+    watcher.setFuture(QtConcurrent::run(renderPage, recording->detached(), imageSize(next), currentZoom));
+}
+
+void PrintPreview::renderFinished()
+{
+    const int page = renderingPage;
+    renderingPage = -1;
+
+    // The pages or the zoom may have changed while the page was being rendered
+    if(page >= 0 && page < pages.size() && renderingGeneration == generation) {
+        const QImage image = watcher.result();
+        // A page larger than the whole cache is kept aside, otherwise it would
+        // be rendered over and over
+        if(!images.insert(page, new QImage(image), cacheCost(ImageCache::imageBytes(image)))) {
+            oversizedPage = page;
+            oversizedImage = image;
+        }
+        emit dataChanged(index(page), index(page));
+        emit pageRendered(page);
+    }
+    scheduleRender();
+}
+
+DisplayList *PrintPreview::pageRecording(int index)
+{
+    if(DisplayList *recording = recordings.object(index))
+        return recording;
+    QQuickItem *page = pages.at(index);
+    if(page == nullptr || printer == nullptr)
+        return nullptr;
+    // Rendered in a worker thread, text is recorded as outlines
+    DisplayList *recording = new DisplayList(printer->recordPage(page, DisplayListRecorder::RasterOutput));
+    recordings.insert(index, recording);
+    return recording;
+}
+
+bool PrintPreview::isRendered(int index) const
+{
+    return index == oversizedPage || images.contains(index);
+}
+
+QSize PrintPreview::imageSize(int index) const
+{
+    QQuickItem *page = pages.at(index);
+    if(page == nullptr)
+        return QSize();
+    return QSize(qCeil(page->width() * currentZoom), qCeil(page->height() * currentZoom));
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef PRINTPREVIEW_H
+#define PRINTPREVIEW_H
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QList>
+#include <QQuickItem>
+#include "displaylist.h"
+
+class QmlPrinter;
+
+// Model of page images for a print preview. Pages are recorded into display
+// lists on the GUI thread the first time they are needed and rendered at the
+// current zoom on a worker thread. Visible pages are rendered first, their
+// neighbours are prefetched when there is nothing else to do.
+//
+// Rendered pages are kept in a least recently used cache, scrolling through
+// a long report only costs the pages which are actually looked at.
+class PrintPreview : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    enum Roles {
+        ImageRole = Qt::UserRole + 1,
+        SizeRole
+    };
+
+    explicit PrintPreview(QmlPrinter *printer, QObject *parent = 0);
+    virtual ~PrintPreview();
+
+    void setPages(const QList<QQuickItem*> &pages);
+
+    void setZoom(qreal zoom);
+    qreal zoom() const;
+
+    // Range of pages currently on screen
+    void setVisiblePages(int first, int last);
+    // Number of pages before and after the visible ones to render ahead
+    void setPrefetch(int pages);
+    // Maximum size of the rendered pages kept in memory
+    void setCacheSize(qint64 bytes);
+
+    // Returns a null image and queues the page if it hasn't been rendered yet
+    QImage pageImage(int index);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QHash<int, QByteArray> roleNames() const;
+signals:
+    void pageRendered(int index);
+private slots:
+    void renderFinished();
+private:
+    void requestPage(int index);
+    void scheduleRender();
+    bool isRendered(int index) const;
+    DisplayList *pageRecording(int index);
+    QSize imageSize(int index) const;
+
+    QmlPrinter *printer;
+    QList<QQuickItem*> pages;
+    qreal currentZoom;
+    int firstVisible;
+    int lastVisible;
+    int prefetch;
+
+    // Display lists are small compared to the rendered images
+    QCache<int, DisplayList> recordings;
+    QCache<int, QImage> images;
+    QList<int> requested;
+    // Last page which didn't fit in the cache, kept so that it isn't
+    // rendered over and over
+    int oversizedPage;
+    QImage oversizedImage;
+
+    // Bumped whenever the pages or the zoom change, results of renders
+    // started before that are dropped
+    int generation;
+
+    QFutureWatcher<QImage> watcher;
+    int renderingPage;
+    int renderingGeneration;
+};
+
+#endif // PRINTPREVIEW_H
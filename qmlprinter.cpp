@@ -7,25 +7,86 @@
  */
 
 #include "qmlprinter.h"
+#include "cachecost.h"
+#include "pdflinearizer.h"
 
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFuture>
 #include <QGraphicsView>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <QtMath>
+
+#include <climits>
+
+#ifdef QMLPRINTER_SCENEGRAPH
+#include "scenegraphpainter.h"
+#endif
+
+namespace {
+
+// Bumped whenever the layout of saveSettings() changes
+const quint32 settingsVersion = 1;
+
+// Plays the part of a page covered by the band into an image of its own,
+// scaled from page coordinates to device pixels
+QImage renderBand(const DisplayList &page, const QRect &band, qreal scaleX, qreal scaleY)
+{
+    QImage image(qCeil(band.width() * scaleX), qCeil(band.height() * scaleY), QImage::Format_RGB32);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
+    painter.scale(scaleX, scaleY);
+    painter.translate(-band.topLeft());
+    page.replay(&painter);
+    painter.end();
+    return image;
+}
+
+}
 
 QmlPrinter::QmlPrinter(QObject *parent) :
-    QObject(parent)
+    QObject(parent),
+    coalesceJobs(true),
+    bandHeight(0),
+    rasterThreshold(0),
+    rasterResolution(300),
+    linearizePDF(false),
+    colorMode(QPrinter::Color),
+    pageGrabWindow(nullptr)
 {
+    setMemoryBudget(512 * 1024 * 1024);
 }
 
 QmlPrinter::~QmlPrinter()
 {
+    end();
+}
 
+QList<QmlPrinter::PagePlan> QmlPrinter::planPages(const QList<QQuickItem *> &items) const
+{
+    // Every page is measured before any of them is resized to fit the paper so
+    // that the orientation only depends on the size the page was designed for
+    QList<PagePlan> plan;
+    plan.reserve(items.length());
+    foreach(QQuickItem *item, items) {
+        PagePlan page;
+        page.item = item;
+        page.orientation = item->width() > item->height() ? QPageLayout::Landscape : QPageLayout::Portrait;
+        page.size = printableSize(page.orientation);
+        plan.append(page);
+    }
+    return plan;
 }
 
-void QmlPrinter::changePrinterOrientation(QPrinter& printer, const int &width, const int &height)
+QSizeF QmlPrinter::printableSize(QPageLayout::Orientation orientation) const
 {
-    if(width > height)
-        printer.setOrientation(QPrinter::Landscape);
-    else
-        printer.setOrientation(QPrinter::Portrait);
+    QPageLayout layout = sessionPrinter->pageLayout();
+    layout.setOrientation(orientation);
+    const int resolution = sessionPrinter->resolution();
+    return sessionPrinter->fullPage() ? layout.fullRectPixels(resolution).size() : layout.paintRectPixels(resolution).size();
 }
 
 bool QmlPrinter::printPDF(const QString &location, QList<QQuickItem*> items, bool showPDF)
@@ -33,41 +94,15 @@ bool QmlPrinter::printPDF(const QString &location, QList<QQuickItem*> items, boo
     if(items.length() == 0) {
         return false;
     }
-    QPrinter printer;
-    printer.setOutputFormat(QPrinter::PdfFormat);
-    printer.setOutputFileName(location);
-    printer.setFullPage(true);
-
-    // Change the printer orientation based on the first page
-    // This needs to be called before the painting is started as it will only take effect
-    // after newPage is called (painter.begin() calls this method)
-    changePrinterOrientation(printer, items.at(0)->width(), items.at(0)->height());
-
-    QPainter painter;
-    // It's possible to fail here for example if the file location does not allow writing
-    if(!painter.begin(&printer)) {
+    if(!beginPDF(location)) {
         return false;
     }
-
-    for(int i = 0; i < items.length(); ++i) {
-        QQuickItem *pageObject = items.at(i);
-        // Change the page width/height to match what the printer gives us
-        // This way all the components will be resized accordingly
-        pageObject->setProperty("width", printer.pageRect().width());
-        pageObject->setProperty("height", printer.pageRect().height());
-
-        paintItem(pageObject, pageObject->window(), &painter);
-
-        // We need to lookahead so we can setup the printer orientation for the next
-        // item and add a new page to the printer
-        int next = i + 1;
-        if(next < items.length()) {
-            changePrinterOrientation(printer, items.at(next)->width(), items.at(next)->height());
-            printer.newPage();
-        }
+    const bool printed = printPages(items);
+    // It's possible to fail when the painting starts for example if the file
+    // location does not allow writing
+    if(!end() || !printed) {
+        return false;
     }
-
-    painter.end();
     if(showPDF) {
         QDesktopServices::openUrl(QUrl("file:///" + location));
     }
@@ -79,56 +114,289 @@ bool QmlPrinter::print(const QPrinterInfo& info, QList<QQuickItem *> items)
     if(items.length() == 0)
         return false;
 
-    QPrinter printer(info);
-    //printer.setFullPage(true);
+    if(!begin(info))
+        return false;
+    const bool printed = printPages(items);
+    return end() && printed;
+}
 
-    // Change the printer orientation based on the first page
-    // This needs to be called before the painting is started as it will only take effect
-    // after newPage is called (painter.begin() calls this method)
-    changePrinterOrientation(printer, items.at(0)->width(), items.at(0)->height());
+bool QmlPrinter::beginPDF(const QString &location)
+{
+    if(isActive())
+        return false;
 
-    QPainter painter;
+    sessionPrinter.reset(new QPrinter);
+    sessionPrinter->setOutputFormat(QPrinter::PdfFormat);
+    if(linearizePDF) {
+        pdfLocation = location;
+        sessionPrinter->setOutputFileName(location + ".partial");
+    } else {
+        sessionPrinter->setOutputFileName(location);
+    }
+    sessionPrinter->setFullPage(true);
+    sessionPrinter->setColorMode(colorMode);
+    coalesceJobs = true;
+    rasterDecisions.clear();
+    jobStats = PrintStats();
+    return true;
+}
 
-    if(!painter.begin(&printer)) {
+bool QmlPrinter::begin(const QPrinterInfo &info, bool coalesce)
+{
+    if(isActive())
         return false;
-    }
-    for(int i = 0; i < items.length(); ++i) {
-        QQuickItem *pageObject = items.at(i);
+
+    sessionPrinter.reset(new QPrinter(info));
+    //sessionPrinter->setFullPage(true);
+    sessionPrinter->setColorMode(colorMode);
+    coalesceJobs = coalesce;
+    rasterDecisions.clear();
+    jobStats = PrintStats();
+    return true;
+}
+
+bool QmlPrinter::printPages(QList<QQuickItem *> items)
+{
+    if(!isActive() || items.length() == 0)
+        return false;
+
+    const QList<PagePlan> plan = planPages(items);
+    foreach(const PagePlan &page, plan) {
+        QQuickItem *pageObject = page.item;
+
+        if(!beginPage(page))
+            return false;
 
         // Change the page width/height to match what the printer gives us
         // This way all the components will be resized accordingly
+        pageObject->setProperty("width", page.size.width());
+        pageObject->setProperty("height", page.size.height());
+
+        if(bandHeight > 0 && sessionPrinter->outputFormat() == QPrinter::NativeFormat) {
+            paintBanded(pageObject);
+        } else {
+            syncSceneGraph(pageObject);
+            if(rasterThreshold > 0)
+                estimateCost(pageObject);
 
-        int width = printer.pageRect().width();
-        int height = printer.pageRect().height();
+            paintItem(pageObject, pageObject->window(), &sessionPainter, pagePaintState(pageObject));
+            rectangleBatch.flush(&sessionPainter);
+        }
+
+        // Release everything which was only needed for this page
+        trackMemory();
+        releasePageGrab();
+        sceneGraphItems.clear();
+        subtreeCosts.clear();
+        ++jobStats.pages;
+    }
+
+    // Without coalescing every document is sent as its own spool job, the
+    // printer itself stays configured for the next one
+    if(!coalesceJobs)
+        return sessionPainter.end();
+    return true;
+}
 
-        /*
-        width -= (printer.pageLayout().margins().right() * 2);
-        height -= (printer.pageLayout().margins().bottom() * 2);*/
+bool QmlPrinter::printImposed(QList<QQuickItem *> items, const Imposition &imposition)
+{
+    if(!isActive() || items.length() == 0)
+        return false;
 
-        pageObject->setProperty("width", width);
-        pageObject->setProperty("height", height);
+    if(imposition.duplex) {
+        const QPrinter::DuplexMode duplex = imposition.layout == Imposition::Booklet ? QPrinter::DuplexShortSide : QPrinter::DuplexLongSide;
+        // The duplex mode is part of the job setup, once painting has started
+        // backends either ignore a change or apply it in the middle of the job
+        if(sessionPainter.isActive() && sessionPrinter->duplex() != duplex) {
+            qWarning() << "QmlPrinter::printImposed duplex imposition has to be printed before anything else in the session";
+            return false;
+        }
+        sessionPrinter->setDuplex(duplex);
+    }
 
-        paintItem(pageObject, pageObject->window(), &painter);
+    const QList<QList<int> > sides = imposition.sides(items.length());
 
-        // We need to lookahead so we can setup the printer orientation for the next
-        // item and add a new page to the printer
-        int next = i + 1;
-        if(next < items.length()) {
-            changePrinterOrientation(printer, items.at(next)->width(), items.at(next)->height());
-            printer.newPage();
+    // Every page is painted once into a display list which is kept until it
+    // has been placed on all of its sides
+    QHash<int, int> remainingUses;
+    foreach(const QList<int> &side, sides) {
+        foreach(int index, side) {
+            if(index >= 0)
+                ++remainingUses[index];
         }
     }
-    painter.end();
+    QHash<int, DisplayList> recordings;
+
+    QQuickItem *first = items.first();
+    PagePlan plan;
+    plan.item = nullptr;
+    plan.orientation = imposition.landscape(QSizeF(first->width(), first->height())) ? QPageLayout::Landscape : QPageLayout::Portrait;
+    plan.size = printableSize(plan.orientation);
+    const QList<QRectF> cells = imposition.cells(plan.size);
+
+    foreach(const QList<int> &side, sides) {
+        if(!beginPage(plan))
+            return false;
+
+        for(int cell = 0; cell < side.size() && cell < cells.size(); ++cell) {
+            const int index = side.at(cell);
+            if(index < 0)
+                continue;
+
+            QQuickItem *page = items.at(index);
+            if(!recordings.contains(index))
+                recordings.insert(index, recordPage(page));
+
+            // Scaled to fit the cell and centered in it
+            const QRectF target = cells.at(cell);
+            const qreal scale = qMin(target.width() / qMax<qreal>(page->width(), 1), target.height() / qMax<qreal>(page->height(), 1));
+            const QSizeF size(page->width() * scale, page->height() * scale);
+            sessionPainter.save();
+            sessionPainter.resetTransform();
+            sessionPainter.setOpacity(1.0);
+            sessionPainter.setClipRect(target);
+            sessionPainter.translate(target.x() + (target.width() - size.width()) / 2, target.y() + (target.height() - size.height()) / 2);
+            sessionPainter.scale(scale, scale);
+            recordings.value(index).replay(&sessionPainter);
+            sessionPainter.restore();
+
+            if(--remainingUses[index] == 0)
+                recordings.remove(index);
+        }
+        ++jobStats.pages;
+    }
+
+    if(!coalesceJobs)
+        return sessionPainter.end();
     return true;
 }
 
-void QmlPrinter::paintItem(QQuickItem *item, QQuickWindow *window, QPainter *painter)
+DisplayList QmlPrinter::recordPage(QQuickItem *page, DisplayListRecorder::Output output)
 {
-    if(!item || !item->isVisible())
+    if(page == nullptr)
+        return DisplayList();
+
+    // Fonts are resolved for the printer during a session, otherwise for the
+    // screen like a QPicture would
+    const int dpi = isActive() ? sessionPrinter->logicalDpiY() : QPicture().logicalDpiY();
+    // Raster fallbacks are limited to the device area
+    DisplayListRecorder recorder(QSize(qCeil(page->width()), qCeil(page->height())), dpi, output);
+    QPainter painter;
+    if(!painter.begin(&recorder))
+        return DisplayList();
+    paintPage(page, &painter);
+    painter.end();
+
+    trackMemory();
+    releasePageGrab();
+    sceneGraphItems.clear();
+    subtreeCosts.clear();
+    return recorder.displayList();
+}
+
+void QmlPrinter::paintPage(QQuickItem *page, QPainter *painter)
+{
+    // Painted in page coordinates instead of scene coordinates so that the
+    // recording can be placed anywhere
+    const QPointF origin = page->mapToScene(QPointF(0, 0));
+    const QTransform toPage = QTransform::fromTranslate(-origin.x(), -origin.y());
+    PaintState state = pagePaintState(page);
+    state.transform *= toPage;
+    state.scene = toPage;
+
+    syncSceneGraph(page);
+    if(rasterThreshold > 0)
+        estimateCost(page);
+    paintItem(page, page->window(), painter, state);
+    rectangleBatch.flush(painter);
+}
+
+bool QmlPrinter::end()
+{
+    if(!isActive())
+        return false;
+
+    trackMemory();
+    bool ok = true;
+    if(sessionPainter.isActive())
+        ok = sessionPainter.end();
+    sessionPrinter.reset();
+
+    if(!pdfLocation.isEmpty()) {
+        const QString partial = pdfLocation + ".partial";
+        if(ok) {
+            PdfLinearizer linearizer;
+            if(!linearizer.linearize(partial, pdfLocation)) {
+                // The document is still complete, it just can't be shown
+                // before it has been downloaded
+                qWarning() << "QmlPrinter::end unable to linearize:" << linearizer.errorString();
+                QFile::remove(pdfLocation);
+                ok = QFile::rename(partial, pdfLocation);
+            }
+        }
+        QFile::remove(partial);
+        pdfLocation.clear();
+    }
+
+    textLayoutCache.clear();
+    textDocumentCache.clear();
+    imageCache.clear();
+    forms.clear();
+    return ok;
+}
+
+bool QmlPrinter::isActive() const
+{
+    return !sessionPrinter.isNull();
+}
+
+bool QmlPrinter::beginPage(const PagePlan &page)
+{
+    // The orientation needs to be changed before the painting is started or
+    // before a new page is added as it only takes effect after newPage is
+    // called (painter.begin() calls this method)
+    sessionPrinter->setPageOrientation(page.orientation);
+
+    if(!sessionPainter.isActive())
+        return sessionPainter.begin(sessionPrinter.data());
+    return sessionPrinter->newPage();
+}
+
+void QmlPrinter::paintItem(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state)
+{
+    // Fully transparent subtrees are not rendered by QtQuick either
+    if(!item || !item->isVisible() || qFuzzyIsNull(state.opacity))
         return;
 
+    // Dynamic items are painted on top of the recorded form instead
+    if(state.form && isDynamicItem(item))
+        return;
+
+    if(!state.rasterized && rasterThreshold > 0) {
+        const SubtreeCost cost = subtreeCosts.value(item);
+        if(cost.primitives >= rasterThreshold && !cost.hasText) {
+            rasterizeItem(item, window, painter, state, cost);
+            return;
+        }
+    }
+
+    if(!state.form && !state.rasterized && isReusableItem(item->metaObject()->className())) {
+        if(paintForm(item, window, painter, state))
+            return;
+    }
+
     bool drawChildren = true;
 
+    // Clipping applies to the whole subtree so it's the only state which needs
+    // to be saved, everything else is set explicitly before drawing each item
+    const bool clip = item->clip();
+    if(clip) {
+        rectangleBatch.flush(painter);
+        painter->save();
+        applyPaintState(painter, state);
+        painter->setClipRect(item->clipRect(), Qt::IntersectClip);
+    }
+
     // This is a bit special case as we need to use childItems instead of children
     if(inherits(item->metaObject(), "QQuickListView")) {
         drawChildren = false;
@@ -140,18 +408,12 @@ void QmlPrinter::paintItem(QQuickItem *item, QQuickWindow *window, QPainter *pai
                 // Draw the child items of the QML ListView
                 QList<QQuickItem*> listViewChildren = listView->childItems();
                 foreach(QQuickItem *children, listViewChildren) {
-                    paintItem(children, window, painter);
+                    paintItem(children, window, painter, childPaintState(children, item, state));
                 }
             }
         }
     }
     else if(isCustomPrintItem(item->metaObject()->className())) {
-        painter->save();
-        if(item->clip()) {
-            painter->setClipping(true);
-            painter->setClipRect(item->clipRect());
-        }
-
         const int boundingMargin = 5;
         QRectF boundingRect;
         boundingRect.setTop(item->boundingRect().top() - boundingMargin);
@@ -159,259 +421,698 @@ void QmlPrinter::paintItem(QQuickItem *item, QQuickWindow *window, QPainter *pai
         boundingRect.setHeight(item->boundingRect().height() + boundingMargin * 2);
         boundingRect.setWidth(item->boundingRect().width() + boundingMargin * 2);
 
+        // The grabbed window is already in scene coordinates and composited
+        // with the item opacity
         const QRectF rect = item->mapRectToScene(boundingRect);
-        QImage image = window->grabWindow();
-        painter->drawImage(rect.x(), rect.y(), image, rect.x(), rect.y(), rect.width(), rect.height());
-        painter->restore();
+        if(window != nullptr) {
+            rectangleBatch.flush(painter);
+            const QRect sceneRect = rect.toAlignedRect();
+            const QImage image = grabScene(window, sceneRect);
+            applyPaintState(painter, scenePaintState(state));
+            drawImage(painter, sceneRect, image, image.rect(), false);
+        }
         drawChildren = false;
     } else if(item->flags().testFlag(QQuickItem::ItemHasContents)) {
-        painter->save();
-        if(item->clip()) {
-            painter->setClipping(true);
-            painter->setClipRect(item->clipRect());
-        }
+        applyPaintState(painter, state);
         if(inherits(item->metaObject(), "QQuickRectangle")) {
             paintQQuickRectangle(item, painter);
-        } else if(inherits(item->metaObject(), "QQuickText")) {
-            paintQQuickText(item, painter);
-        } else if(inherits(item->metaObject(), "QQuickImage")) {
-            paintQQuickImage(item, painter);
-        } else if(inherits(item->metaObject(), "QQuickCanvasItem")) {
-            paintQQuickCanvasItem(item, window, painter);
         } else {
-            // Fallback to screen capture if we are unable to parse the data
-            QRect rect = item->mapRectFromScene(item->boundingRect()).toRect();
-            if(window != nullptr) {
-                QImage image = window->grabWindow();
-
-                painter->drawImage(rect, image, QRect(rect.x(), rect.y(), rect.width(), rect.height()));
+            // Anything else drawn on top of pending rectangles has to keep its
+            // stacking order
+            rectangleBatch.flush(painter);
+
+            if(inherits(item->metaObject(), "QQuickText")) {
+                paintQQuickText(item, painter);
+            } else if(inherits(item->metaObject(), "QQuickImage")) {
+                paintQQuickImage(item, painter);
+            } else if(inherits(item->metaObject(), "QQuickCanvasItem")) {
+                paintQQuickCanvasItem(item, window, painter, state);
+            } else if(!paintSceneGraphNodes(item, painter)) {
+                // Fallback to screen capture if we are unable to parse the data
+                QRect rect = item->mapRectToScene(item->boundingRect()).toRect();
+                if(window != nullptr) {
+                    const QImage image = grabScene(window, rect);
+
+                    applyPaintState(painter, scenePaintState(state));
+                    drawImage(painter, rect, image, image.rect(), false);
+                }
+                drawChildren = false;
             }
-            drawChildren = false;
         }
-        painter->restore();
     }
     if(drawChildren) {
         const QObjectList children = item->children();
         foreach(QObject *obj, children) {
-            paintItem(qobject_cast<QQuickItem*>(obj), window, painter);
+            QQuickItem *child = qobject_cast<QQuickItem*>(obj);
+            if(child)
+                paintItem(child, window, painter, childPaintState(child, item, state));
         }
     }
+    if(clip) {
+        rectangleBatch.flush(painter);
+        painter->restore();
+    }
 }
 
-void QmlPrinter::paintQQuickCanvasItem(QQuickItem *item, QQuickWindow *window, QPainter *painter)
+bool QmlPrinter::paintSceneGraphNodes(QQuickItem *item, QPainter *painter)
 {
-    // No point in continuing as we are unable to grab the image
-    if(window == nullptr)
+    // Nodes the renderer has built are preferred over a grab, children are
+    // painted normally after the item content
+    const QHash<QQuickItem*, DisplayList>::const_iterator nodes = sceneGraphItems.constFind(item);
+    if(nodes == sceneGraphItems.constEnd())
+        return false;
+    nodes.value().replay(painter);
+    return true;
+}
+
+void QmlPrinter::syncSceneGraph(QQuickItem *page)
+{
+#ifdef QMLPRINTER_SCENEGRAPH
+    sceneGraphItems.clear();
+    QQuickWindow *window = page->window();
+    if(window == nullptr || window->thread() != QThread::currentThread() || !hasSceneGraphItems(page))
         return;
 
-    const QRectF rect = item->mapRectToScene(item->boundingRect());
+    // The page was just resized, its nodes only follow once the window has
+    // been polished and synchronized. They are copied while the render thread
+    // synchronizes as that is the only time the GUI thread is blocked and the
+    // nodes still hold their images.
+    const QMetaObject::Connection connection = connect(window, &QQuickWindow::afterSynchronizing, window,
+                                                       [this, page]() { recordSceneGraphNodes(page); },
+                                                       Qt::DirectConnection);
+    // A grab runs a full polish, sync and render, the result serves the
+    // fallbacks of this page
+    pageGrab = window->grabWindow();
+    pageGrabWindow = window;
+    disconnect(connection);
+    trackMemory();
+#else
+    Q_UNUSED(page)
+#endif
+}
 
-    QImage image = window->grabWindow();
-    painter->drawImage(rect.x(), rect.y(), image, rect.x(), rect.y(), rect.width(), rect.height());
+void QmlPrinter::recordSceneGraphNodes(QQuickItem *item)
+{
+#ifdef QMLPRINTER_SCENEGRAPH
+    if(!item->isVisible())
+        return;
 
+    if(isSceneGraphItem(item)) {
+        DisplayListRecorder recorder(QSize(qCeil(item->width()), qCeil(item->height())), 96);
+        QPainter painter;
+        if(painter.begin(&recorder)) {
+            const bool painted = SceneGraphPainter::paint(item, &painter);
+            painter.end();
+            if(painted)
+                sceneGraphItems.insert(item, recorder.displayList());
+        }
+    }
+    foreach(QQuickItem *child, item->childItems())
+        recordSceneGraphNodes(child);
+#else
+    Q_UNUSED(item)
+#endif
+}
 
+bool QmlPrinter::isSceneGraphItem(QQuickItem *item)
+{
+    // Items which paintItem() has no painter of its own for
+    const QMetaObject *metaObject = item->metaObject();
+    return item->flags().testFlag(QQuickItem::ItemHasContents)
+            && !isCustomPrintItem(metaObject->className())
+            && !inherits(metaObject, "QQuickRectangle")
+            && !inherits(metaObject, "QQuickText")
+            && !inherits(metaObject, "QQuickImage")
+            && !inherits(metaObject, "QQuickCanvasItem");
 }
 
-void QmlPrinter::paintQQuickRectangle(QQuickItem *item, QPainter *painter)
+bool QmlPrinter::hasSceneGraphItems(QQuickItem *item)
 {
-    const QRect rect = item->mapRectToScene(item->boundingRect()).toRect();
-    const QColor color = item->property("color").value<QColor>();
-    const QObject* border = item->property("border").value<QObject*>();
-    const qreal border_width = border->property("width").value<qreal>();
-    const QColor border_color = border->property("color").value<QColor>();
-    const qreal radius = item->property("radius").value<qreal>();
-    const qreal opacity = item->property("opacity").value<qreal>();
+    if(!item->isVisible())
+        return false;
+    if(isSceneGraphItem(item))
+        return true;
+    foreach(QQuickItem *child, item->childItems()) {
+        if(hasSceneGraphItems(child))
+            return true;
+    }
+    return false;
+}
 
-    painter->setBrush(color);
-    painter->setOpacity(opacity);
+bool QmlPrinter::paintForm(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    // The opacity ends up in the recorded commands
+    stream << state.opacity;
+    if(!hashSubtree(item, nullptr, stream))
+        return false;
+    const QByteArray key = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+
+    DisplayList *form = forms.object(key);
+    if(!form) {
+        // Rectangles still pending for the page must not end up in the form
+        rectangleBatch.flush(painter);
+        const QRect bounds = item->boundingRect().united(item->childrenRect()).toAlignedRect();
+        DisplayListRecorder recorder(QSize(qMax(1, bounds.right() + 1), qMax(1, bounds.bottom() + 1)),
+                                     painter->device()->logicalDpiY(), DisplayListRecorder::VectorOutput);
+        QPainter recordingPainter;
+        if(!recordingPainter.begin(&recorder))
+            return false;
+        PaintState formState;
+        formState.opacity = state.opacity;
+        formState.form = true;
+        paintItem(item, window, &recordingPainter, formState);
+        rectangleBatch.flush(&recordingPainter);
+        recordingPainter.end();
+
+        form = new DisplayList(recorder.displayList());
+        forms.insert(key, form, cacheCost(form->bytes()));
+    }
 
-    if(border_width > 0 and not (border_width == 1 and border_color == QColor(Qt::black))) {
-        painter->setPen(QPen(border_color, border_width));
-    } else {
-        painter->setPen(Qt::NoPen);
+    rectangleBatch.flush(painter);
+    painter->save();
+    painter->setWorldTransform(state.transform);
+    // The recorded opacity is absolute like the rest of the item state
+    painter->setOpacity(1.0);
+    form->replay(painter);
+    painter->restore();
+
+    paintDynamicItems(item, window, painter, state);
+    return true;
+}
+
+void QmlPrinter::paintDynamicItems(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state)
+{
+    // Painted after the form so they end up on top of it
+    foreach(QQuickItem *child, item->childItems()) {
+        if(!child->isVisible())
+            continue;
+        const PaintState childState = childPaintState(child, item, state);
+        if(isDynamicItem(child))
+            paintItem(child, window, painter, childState);
+        else
+            paintDynamicItems(child, window, painter, childState);
     }
+}
 
-    if(radius > 0) {
-        painter->drawRoundedRect(rect, radius, radius);
-    } else {
-        painter->drawRect(rect);
+bool QmlPrinter::hashSubtree(QQuickItem *item, QQuickItem *parent, QDataStream &stream)
+{
+    stream << QByteArray(item->metaObject()->className()) << item->isVisible();
+    if(!item->isVisible())
+        return true;
+
+    const QTransform transform = parent ? item->itemTransform(parent, nullptr) : QTransform();
+    stream << item->width() << item->height() << item->opacity() << item->clip() << transform;
+
+    // Only the position of dynamic items matters, their content is painted
+    // separately
+    if(isDynamicItem(item))
+        return true;
+
+    if(item->flags().testFlag(QQuickItem::ItemHasContents)) {
+        if(inherits(item->metaObject(), "QQuickRectangle")) {
+            const RectangleProperties rectangle = RectangleProperties::read(item);
+            stream << rectangle.color << rectangle.borderWidth << rectangle.borderColor << rectangle.radius
+                   << rectangle.gradientStops << int(rectangle.gradientOrientation);
+        } else if(inherits(item->metaObject(), "QQuickText")) {
+            const TextProperties text = TextProperties::read(item);
+            stream << text.font << text.text << text.color << text.wrapMode << text.textFormat
+                   << text.horizontalAlignment << text.verticalAlignment << text.elide;
+        } else {
+            // Images are shared through the image cache already and the hash
+            // doesn't cover their content, anything grabbed from the screen
+            // can change between pages. Either keeps the subtree out of forms.
+            return false;
+        }
+    }
+
+    // Rasterized subtrees would end up in the form as images as well
+    if(rasterThreshold > 0) {
+        const SubtreeCost cost = subtreeCosts.value(item);
+        if(cost.primitives >= rasterThreshold && !cost.hasText)
+            return false;
     }
 
+    foreach(QQuickItem *child, item->childItems()) {
+        if(!hashSubtree(child, item, stream))
+            return false;
+    }
+    return true;
 }
 
-void QmlPrinter::paintQQuickText(QQuickItem *item, QPainter *painter)
+bool QmlPrinter::isDynamicItem(QQuickItem *item) const
 {
-    const QRectF rect = item->mapRectToScene(item->boundingRect());
-    const QFont font = item->property("font").value<QFont>();
-    const QString text = item->property("text").value<QString>();
-    const QColor color = item->property("color").value<QColor>();
-    const int wrapMode = item->property("wrapMode").value<int>();
-    int textFormat = item->property("textFormat").value<int>();
-    const int horizontalAlignment = item->property("horizontalAlignment").value<int>();
-    const int verticalAlignment   = item->property("verticalAlignment").value<int>();
+    return item->property("printDynamic").toBool();
+}
 
-    const int elide = item->property("elide").value<int>();
-    Qt::TextElideMode elideMode = static_cast<Qt::TextElideMode>(elide);
+void QmlPrinter::paintBanded(QQuickItem *page)
+{
+    const QSize size(qCeil(page->width()), qCeil(page->height()));
+    if(size.isEmpty())
+        return;
 
-    QTextOption textOption;
-    textOption.setWrapMode(QTextOption::WrapMode(wrapMode));
-    textOption.setAlignment(static_cast<Qt::Alignment>(horizontalAlignment | verticalAlignment));
+    // The page items are in the printer's logical pixels, the bands are
+    // rendered at its physical resolution
+    const qreal scaleX = qMax<qreal>(1, qreal(sessionPrinter->physicalDpiX()) / sessionPrinter->logicalDpiX());
+    const qreal scaleY = qMax<qreal>(1, qreal(sessionPrinter->physicalDpiY()) / sessionPrinter->logicalDpiY());
 
-    QFontMetrics fm(font);
+    // The page is recorded once and every band replays it. Images in a display
+    // list are shared instead of serialized, no band decodes them again.
+    DisplayListRecorder recorder(size, sessionPrinter->logicalDpiX());
+    QPainter painter;
+    if(!painter.begin(&recorder))
+        return;
+    paintPage(page, &painter);
+    painter.end();
+    const DisplayList list = recorder.displayList();
+
+    // Bands in flight are limited by the number of cores and by the memory
+    // budget, a quarter of which is given to band images
+    const int inFlight = qMax(1, QThread::idealThreadCount());
+    const qint64 rowBytes = qint64(qCeil(size.width() * scaleX)) * 4;
+    const qint64 budgetRows = memoryBudget / 4 / inFlight / rowBytes;
+    const int deviceRows = int(qBound<qint64>(1, budgetRows, bandHeight));
+    const int height = qMax(1, int(deviceRows / scaleY));
+
+    QList<QRect> bands;
+    for(int y = 0; y < size.height(); y += height) {
+        bands << QRect(0, y, size.width(), qMin(height, size.height() - y));
+    }
 
-    if(textFormat == Qt::AutoText) {
-        textFormat = Qt::mightBeRichText(text) ? 4 : Qt::PlainText;
+    QList<QFuture<QImage> > pending;
+    int next = 0;
+    for(int i = 0; i < bands.size(); ++i) {
+        while(next < bands.size() && next < i + inFlight) {
+            pending << QtConcurrent::run(renderBand, list.detached(), bands.at(next), scaleX, scaleY);
+            ++next;
+        }
+
+        // Later bands keep rendering while this one is sent to the printer
+        const QImage band = pending.takeFirst().result();
+        trackMemory(rowBytes * qCeil(height * scaleY) * (next - i));
+        sessionPainter.resetTransform();
+        sessionPainter.setOpacity(1.0);
+        sessionPainter.drawImage(QRectF(bands.at(i)), band);
     }
+}
 
-    switch (textFormat) {
-        case Qt::PlainText: {
-            painter->setFont(font);
-            painter->setPen(color);
+QmlPrinter::SubtreeCost QmlPrinter::estimateCost(QQuickItem *item)
+{
+    SubtreeCost cost;
+    if(!item || !item->isVisible())
+        return cost;
+
+    if(item->flags().testFlag(QQuickItem::ItemHasContents)) {
+        cost.primitives = 1;
+        cost.hasText = inherits(item->metaObject(), "QQuickText");
+    }
+    foreach(QQuickItem *child, item->childItems()) {
+        const SubtreeCost childCost = estimateCost(child);
+        cost.primitives += childCost.primitives;
+        cost.hasText = cost.hasText || childCost.hasText;
+    }
+    subtreeCosts.insert(item, cost);
+    return cost;
+}
+
+void QmlPrinter::rasterizeItem(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state, const SubtreeCost &cost)
+{
+    // Area covered by the subtree on the device, limited to the page
+    const QRectF itemRect = item->boundingRect() | item->childrenRect();
+    QRectF deviceRect = state.transform.mapRect(itemRect);
+    deviceRect &= QRectF(0, 0, painter->device()->width(), painter->device()->height());
+    if(deviceRect.isEmpty())
+        return;
+
+    qreal scale = qreal(rasterResolution) / painter->device()->logicalDpiX();
+    // Lower the resolution rather than exceed the memory budget
+    const qreal imageBytes = deviceRect.width() * deviceRect.height() * scale * scale * 4;
+    if(imageBytes > memoryBudget / 2)
+        scale *= qSqrt(memoryBudget / 2 / imageBytes);
+    QImage image(qCeil(deviceRect.width() * scale), qCeil(deviceRect.height() * scale), QImage::Format_ARGB32_Premultiplied);
+    if(image.isNull())
+        return;
+    image.fill(Qt::transparent);
+    trackMemory(ImageCache::imageBytes(image));
+
+    rectangleBatch.flush(painter);
+
+    // Paint the subtree with the same traversal, mapping device coordinates
+    // to the image
+    const QTransform toImage = QTransform::fromTranslate(-deviceRect.x(), -deviceRect.y()) * QTransform::fromScale(scale, scale);
+    PaintState imageState = state;
+    imageState.transform = state.transform * toImage;
+    imageState.scene = state.scene * toImage;
+    imageState.rasterized = true;
+
+    QPainter imagePainter(&image);
+    imagePainter.setRenderHint(QPainter::Antialiasing, true);
+    imagePainter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+    paintItem(item, window, &imagePainter, imageState);
+    rectangleBatch.flush(&imagePainter);
+    imagePainter.end();
+
+    PaintState deviceState = state;
+    deviceState.transform = QTransform();
+    deviceState.opacity = 1.0;
+    applyPaintState(painter, deviceState);
+    drawImage(painter, deviceRect, image, image.rect(), false);
+
+    RasterDecision decision;
+    decision.className = item->metaObject()->className();
+    decision.objectName = item->objectName();
+    decision.primitives = cost.primitives;
+    decision.rect = deviceRect;
+    rasterDecisions.append(decision);
+}
 
-            QRectF textRect = rect;
+QmlPrinter::PaintState QmlPrinter::childPaintState(QQuickItem *child, QQuickItem *parent, const PaintState &parentState)
+{
+    // itemTransform composes position, scale, rotation and the transform list
+    // of every item between the child and the given parent
+    PaintState state = parentState;
+    state.transform = child->itemTransform(parent, nullptr) * parentState.transform;
+    state.opacity = parentState.opacity * child->opacity();
+    return state;
+}
 
-            if(item->rotation() != 0) {
-                int xc = rect.x() + rect.width() / 2;
-                int yc = rect.y() + rect.height() / 2;
+void QmlPrinter::applyPaintState(QPainter *painter, const PaintState &state)
+{
+    // Only touch the painter when something actually changes, every change
+    // ends up as a graphics state operator in the PDF content stream
+    if(painter->worldTransform() != state.transform)
+        painter->setWorldTransform(state.transform);
+    if(painter->opacity() != state.opacity)
+        painter->setOpacity(state.opacity);
+}
 
-                QMatrix matrix;
-                matrix.translate(xc, yc);
-                matrix.rotate(item->rotation());
+QmlPrinter::PaintState QmlPrinter::pagePaintState(QQuickItem *page)
+{
+    // Pages are painted in scene coordinates so that screen grabs line up
+    PaintState state;
+    state.transform = page->itemTransform(nullptr, nullptr);
+    state.opacity = page->opacity();
+    return state;
+}
 
-                painter->setMatrix(matrix);
-                painter->setMatrixEnabled(true);
+QmlPrinter::PaintState QmlPrinter::scenePaintState(const PaintState &state)
+{
+    // Screen grabs are in scene coordinates and already composited with the
+    // item opacity
+    PaintState sceneState = state;
+    sceneState.transform = state.scene;
+    sceneState.opacity = 1.0;
+    return sceneState;
+}
 
-                double PI = 3.14159265358979323846;
-                double cosine = cos(static_cast<double>(item->rotation()) * PI / 180.0);
-                double sine = sin(static_cast<double>(item->rotation()) * PI / 180.0);
+void QmlPrinter::paintQQuickCanvasItem(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state)
+{
+    // No point in continuing as we are unable to grab the image
+    if(window == nullptr)
+        return;
 
-                textRect = QRectF(-abs(sine) * rect.height() * 0.5,
-                                  abs(cosine) * rect.width() * 0.5,
-                                  rect.height(), rect.width());
-            }
-            bool fontModified;
-            QTextLayout textLayout;
-            textLayout.setFont(font);
-            textLayout.setTextOption(textOption);
-            QTextCharFormat defaultFormat;
-            defaultFormat.setForeground(color);
-
-            QList<StyledTextImgTag*> tags;
-            StyledText::parse(text, textLayout, tags, QUrl(), qmlContext(item), true, &fontModified, defaultFormat);
-
-            QString elidedText = textLayout.text();
-            if(elideMode != Qt::ElideNone) {
-                elidedText = fm.elidedText(elidedText, elideMode, item->width());
-                textLayout.setText(elidedText);
-            }
+    const QRect rect = item->mapRectToScene(item->boundingRect()).toAlignedRect();
 
-            textLayout.beginLayout();
+    const QImage image = grabScene(window, rect);
+    applyPaintState(painter, scenePaintState(state));
+    drawImage(painter, rect, image, image.rect(), false);
+}
 
-            switch(textOption.wrapMode()) {
-            case QTextOption::NoWrap:
-                textLayout.createLine();
-                break;
-            case QTextOption::WordWrap:
-            case QTextOption::ManualWrap:
-            case QTextOption::WrapAnywhere:
-            case QTextOption::WrapAtWordBoundaryOrAnywhere: {
-                int height = 0;
-                forever {
-                    QTextLine line = textLayout.createLine();
-                    if(!line.isValid())
-                        break;
-                    line.setLineWidth(item->width());
-                    line.setPosition(QPointF(0, height));
-                    height += line.height();
-                }
-            } break;
-            default:
-                break;
-            }
+QImage QmlPrinter::grabScene(QQuickWindow *window, const QRect &rect)
+{
+    // Grabbing has to happen in the thread the window lives in, from anywhere
+    // else the render loop could be used by two threads at once
+    if(window->thread() != QThread::currentThread()) {
+        qWarning() << "QmlPrinter::grabScene window belongs to another thread";
+        return QImage();
+    }
 
-            textLayout.endLayout();
-            textLayout.draw(painter, textRect.topLeft());
+    // The window is grabbed once per page, every fallback on the page crops
+    // its own area from that grab
+    if(pageGrab.isNull() || pageGrabWindow != window) {
+        pageGrab = window->grabWindow();
+        pageGrabWindow = window;
+        trackMemory();
+    }
 
-        } break;
-        default:
-        case 4: {
-            bool fontModified;
-            QTextLayout textLayout;
-            textLayout.setFont(font);
-            textLayout.setTextOption(textOption);
-            QTextCharFormat defaultFormat;
-            defaultFormat.setForeground(color);
+    const QImage image = pageGrab.copy(rect);
+    // Don't hold on to large grabs when memory is tight
+    if(ImageCache::imageBytes(pageGrab) > memoryBudget / 4)
+        releasePageGrab();
+    return image;
+}
 
-            QList<StyledTextImgTag*> tags;
-            StyledText::parse(text, textLayout, tags, QUrl(), qmlContext(item), true, &fontModified, defaultFormat);
+void QmlPrinter::releasePageGrab()
+{
+    pageGrab = QImage();
+    pageGrabWindow = nullptr;
+}
 
+void QmlPrinter::trackMemory(qint64 transientBytes)
+{
+    const qint64 cacheBytes = imageCache.cost() + textLayoutCache.cost() + textDocumentCache.cost()
+            + cacheCostBytes(forms.totalCost());
+    const qint64 totalBytes = cacheBytes + ImageCache::imageBytes(pageGrab) + transientBytes;
+    jobStats.peakCacheMemory = qMax(jobStats.peakCacheMemory, cacheBytes);
+    jobStats.peakMemory = qMax(jobStats.peakMemory, totalBytes);
+    // The text layout cache is cleared at the end of every job, its counters
+    // are those of the current job
+    jobStats.textLayoutHits = textLayoutCache.hits();
+    jobStats.textLayoutMisses = textLayoutCache.misses();
+    jobStats.uniqueImages = qMax(jobStats.uniqueImages, imageCache.uniqueImages());
+}
 
-            textLayout.beginLayout();
-            int height = 0;
-            const int leading = 0;
-            while (1) {
-                QTextLine line = textLayout.createLine();
-                if (!line.isValid())
-                    break;
+void QmlPrinter::paintQQuickRectangle(QQuickItem *item, QPainter *painter)
+{
+    QRectF rect = item->boundingRect();
+    const RectangleProperties properties = RectangleProperties::read(item);
+    const QColor &color = properties.color;
+    const qreal border_width = properties.borderWidth;
+    const QColor &border_color = properties.borderColor;
+    // QtQuick clamps the radius so that the corners never overlap
+    qreal radius = qMin(properties.radius, qMin(rect.width(), rect.height()) / 2);
+
+    // QQuickPen doesn't tell whether the border was set, the default 1px black
+    // border is treated as unset
+    QPen pen(Qt::NoPen);
+    if(border_width > 0 and border_color.alpha() > 0 and not (border_width == 1 and border_color == QColor(Qt::black))) {
+        pen = QPen(border_color, border_width);
+        pen.setJoinStyle(Qt::MiterJoin);
+
+        // The border is drawn inside the rectangle, stroke along the center
+        // line of the border so that it covers exactly that area
+        const qreal halfWidth = qMin(border_width, qMin(rect.width(), rect.height()) / 2) / 2;
+        rect.adjust(halfWidth, halfWidth, -halfWidth, -halfWidth);
+        radius = qMax<qreal>(0, radius - halfWidth);
+    }
 
-                line.setLineWidth(item->width());
-                height += leading;
-                line.setPosition(QPointF(0, height));
-                height += line.height();
-            }
-            textLayout.endLayout();
+    QBrush brush(color);
+    if(!properties.gradientStops.isEmpty()) {
+        const QRectF bounds = item->boundingRect();
+        QLinearGradient gradient(bounds.topLeft(),
+                                 properties.gradientOrientation == Qt::Horizontal ? bounds.topRight() : bounds.bottomLeft());
+        gradient.setStops(properties.gradientStops);
+        brush = QBrush(gradient);
+    }
 
-            painter->setRenderHint(QPainter::Antialiasing, true);
-            textLayout.draw(painter, rect.topLeft());
-        } break;
-        case Qt::RichText: {
-            QRectF textRect = rect;
-            if(item->rotation() != 0) {
-                int xc = rect.x() + rect.width() / 2;
-                int yc = rect.y() + rect.height() / 2;
+    // Transparent containers don't produce any output
+    if(brush.style() == Qt::SolidPattern && color.alpha() == 0 && pen.style() == Qt::NoPen)
+        return;
 
-                QMatrix matrix;
-                matrix.translate(xc, yc);
-                matrix.rotate(item->rotation());
+    // The batch keeps the hint rectangles were added with. The hint is put
+    // back afterwards so that it doesn't carry over to the following items.
+    const bool antialiasing = painter->testRenderHint(QPainter::Antialiasing);
+    painter->setRenderHint(QPainter::Antialiasing, item->antialiasing() || radius > 0);
+    if(!rectangleBatch.add(painter, rect, radius, brush, pen)) {
+        rectangleBatch.flush(painter);
+        painter->setBrush(brush);
+        painter->setPen(pen);
+
+        if(radius > 0) {
+            painter->drawRoundedRect(rect, radius, radius);
+        } else {
+            painter->drawRect(rect);
+        }
+    }
+    painter->setRenderHint(QPainter::Antialiasing, antialiasing);
+}
 
-                painter->setMatrix(matrix);
-                painter->setMatrixEnabled(true);
+void QmlPrinter::paintQQuickText(QQuickItem *item, QPainter *painter)
+{
+    const QRectF rect = item->boundingRect();
+    const TextProperties properties = TextProperties::read(item);
+    const QFont &font = properties.font;
+    const QString &text = properties.text;
+    const QColor &color = properties.color;
+    const int wrapMode = properties.wrapMode;
+    int textFormat = properties.textFormat;
+    const int horizontalAlignment = properties.horizontalAlignment;
+    const int verticalAlignment   = properties.verticalAlignment;
+
+    const int elide = properties.elide;
+    Qt::TextElideMode elideMode = static_cast<Qt::TextElideMode>(elide);
 
-                double PI = 3.14159265358979323846;
-                double cosine = cos(static_cast<double>(item->rotation()) * PI / 180.0);
-                double sine = sin(static_cast<double>(item->rotation()) * PI / 180.0);
+    QTextOption textOption;
+    textOption.setWrapMode(QTextOption::WrapMode(wrapMode));
+    textOption.setAlignment(static_cast<Qt::Alignment>(horizontalAlignment | verticalAlignment));
 
-                textRect = QRectF(-abs(sine) * rect.height() * 0.5,
-                                  abs(cosine) * rect.width() * 0.5,
-                                  rect.height(), rect.width());
-            }
+    if(textFormat == Qt::AutoText) {
+        textFormat = Qt::mightBeRichText(text) ? 4 : Qt::PlainText;
+    }
 
-            QTextDocument document;
-            document.setTextWidth(textRect.width());
-            document.setDefaultTextOption(textOption);
-            document.setDefaultFont(font);
-            document.setHtml(text);
+    TextLayoutKey key;
+    key.text = text;
+    key.font = font;
+    key.color = color;
+    key.width = item->width();
+    key.textFormat = textFormat;
+    key.wrapMode = wrapMode;
+    key.alignment = horizontalAlignment | verticalAlignment;
+    key.elide = elideMode;
+
+    // Styled and rich text turn antialiasing on for their decorations
+    const bool antialiasing = painter->testRenderHint(QPainter::Antialiasing);
+    switch (textFormat) {
+        case Qt::PlainText: {
+            painter->setFont(font);
+            painter->setPen(color);
+            drawTextLayout(painter, *textLayout(item, key, textOption), rect.topLeft());
+        } break;
+        default:
+        case 4: {
+            painter->setRenderHint(QPainter::Antialiasing, true);
+            textLayout(item, key, textOption)->draw(painter, rect.topLeft());
+        } break;
+        case Qt::RichText: {
+            // The colour is only applied when drawing so documents can be
+            // shared between items of different colours
+            TextLayoutKey documentKey = key;
+            documentKey.color = QColor();
+            QTextDocument *document = textDocumentCache.document(documentKey, textOption);
 
             QAbstractTextDocumentLayout::PaintContext context;
             context.palette.setColor(QPalette::Text, color);
 
-            QAbstractTextDocumentLayout *layout = document.documentLayout();
-            painter->translate(textRect.topLeft());
+            QAbstractTextDocumentLayout *layout = document->documentLayout();
+            painter->translate(rect.topLeft());
             painter->setRenderHint(QPainter::Antialiasing, true);
             layout->draw(painter, context);
         } break;
     }
+    painter->setRenderHint(QPainter::Antialiasing, antialiasing);
+}
+
+void QmlPrinter::drawTextLayout(QPainter *painter, const QTextLayout &layout, const QPointF &position)
+{
+    // Recordings keep the glyphs shaped here so that replaying them, for
+    // example forms on every page, doesn't shape the text again
+    DisplayListRecorder *recorder = dynamic_cast<DisplayListRecorder*>(painter->device());
+    if(!recorder) {
+        layout.draw(painter, position);
+        return;
+    }
+    foreach(const QGlyphRun &glyphRun, layout.glyphRuns())
+        recorder->drawGlyphRun(painter, position, glyphRun);
+}
+
+QSharedPointer<QTextLayout> QmlPrinter::textLayout(QQuickItem *item, const TextLayoutKey &key, const QTextOption &textOption)
+{
+    QSharedPointer<QTextLayout> layout = textLayoutCache.layout(key);
+    if(!layout.isNull())
+        return layout;
+
+    layout = QSharedPointer<QTextLayout>(new QTextLayout);
+    layout->setFont(key.font);
+    layout->setTextOption(textOption);
+    layout->setCacheEnabled(true);
+
+    if(key.textFormat == Qt::PlainText) {
+        // Plain text has no tags to parse, it's drawn with the painter pen
+        layout->setText(plainText(key));
+
+        layout->beginLayout();
+        switch(textOption.wrapMode()) {
+        case QTextOption::NoWrap:
+            layout->createLine();
+            break;
+        case QTextOption::WordWrap:
+        case QTextOption::ManualWrap:
+        case QTextOption::WrapAnywhere:
+        case QTextOption::WrapAtWordBoundaryOrAnywhere: {
+            int height = 0;
+            forever {
+                QTextLine line = layout->createLine();
+                if(!line.isValid())
+                    break;
+                line.setLineWidth(key.width);
+                line.setPosition(QPointF(0, height));
+                height += line.height();
+            }
+        } break;
+        default:
+            break;
+        }
+        layout->endLayout();
+    } else {
+        bool fontModified;
+        QTextCharFormat defaultFormat;
+        defaultFormat.setForeground(key.color);
+
+        QList<StyledTextImgTag*> tags;
+        StyledText::parse(key.text, *layout, tags, QUrl(), qmlContext(item), true, &fontModified, defaultFormat);
+        qDeleteAll(tags);
+
+        layout->beginLayout();
+        int height = 0;
+        const int leading = 0;
+        while (1) {
+            QTextLine line = layout->createLine();
+            if (!line.isValid())
+                break;
+
+            line.setLineWidth(key.width);
+            height += leading;
+            line.setPosition(QPointF(0, height));
+            height += line.height();
+        }
+        layout->endLayout();
+    }
+
+    textLayoutCache.insert(key, layout);
+    return layout;
+}
+
+QString QmlPrinter::plainText(const TextLayoutKey &key)
+{
+    QString text = key.text;
+    text.replace(QLatin1Char('\n'), QChar::LineSeparator);
+    if(key.elide != Qt::ElideNone) {
+        const QFontMetricsF &fm = textLayoutCache.fontMetrics(key.font);
+        text = fm.elidedText(text, static_cast<Qt::TextElideMode>(key.elide), key.width);
+    }
+    return text;
 }
 
 void QmlPrinter::paintQQuickImage(QQuickItem *item, QPainter *painter)
 {
-    const QUrl url = item->property("source").value<QUrl>();
-    const int fillMode = item->property("fillMode").value<int>();
+    const ImageProperties properties = ImageProperties::read(item);
+    const QUrl &url = properties.source;
+    const int fillMode = properties.fillMode;
+
+    const QImage image = loadImage(url, properties.sourceSize);
+    if(image.isNull())
+        return;
 
-    QImage image(url.toLocalFile());
+    const QRectF bounds = item->boundingRect();
+    const QSizeF imageSize = image.size();
 
-    QRect rect = item->mapRectToScene(item->boundingRect()).toRect();
-    QRect sourceRect(0, 0, image.width(), image.height());
+    // Geometry of the image in item coordinates, either a single draw from
+    // sourceRect to targetRect or a tiled fill of targetRect
+    QRectF targetRect = bounds;
+    QRectF sourceRect(QPointF(0, 0), imageSize);
+    bool tiled = false;
+    QSizeF tileSize = imageSize;
 
     switch(fillMode)
     {
@@ -420,23 +1121,289 @@ void QmlPrinter::paintQQuickImage(QQuickItem *item, QPainter *painter)
         case 0: // Image.Stretch
             break;
         case 1: { // Image.PreserveAspectFit
-            QSize size = sourceRect.size();
-            size.scale(rect.width(), rect.height(), Qt::KeepAspectRatio);
+            const QSizeF size = imageSize.scaled(bounds.size(), Qt::KeepAspectRatio);
+            targetRect = QRectF(alignedPosition(bounds, size, properties.horizontalAlignment, properties.verticalAlignment), size);
         } break;
-        case 6: { // Image.Pad
-            if(sourceRect.width() > rect.width()) {
-                rect.setWidth(sourceRect.width());
-            } else {
-                sourceRect.setWidth(rect.width());
-            }
-            if(sourceRect.height() > rect.height()){
-                rect.setHeight(sourceRect.height());
-            } else {
-                sourceRect.setHeight(rect.height());
-            }
+        case 2: { // Image.PreserveAspectCrop
+            const QSizeF size = imageSize.scaled(bounds.size(), Qt::KeepAspectRatioByExpanding);
+            // Crop in image coordinates so that only the visible part is drawn
+            const qreal scale = size.width() / imageSize.width();
+            const QPointF offset = alignedPosition(QRectF(QPointF(0, 0), size), bounds.size(),
+                                                   properties.horizontalAlignment, properties.verticalAlignment);
+            sourceRect = QRectF(offset / scale, bounds.size() / scale);
         } break;
+        case 3: // Image.Tile
+            tiled = true;
+            break;
+        case 4: // Image.TileVertically
+            tiled = true;
+            tileSize.setWidth(bounds.width());
+            break;
+        case 5: // Image.TileHorizontally
+            tiled = true;
+            tileSize.setHeight(bounds.height());
+            break;
+        case 6: // Image.Pad
+            targetRect = QRectF(alignedPosition(bounds, imageSize, properties.horizontalAlignment, properties.verticalAlignment), imageSize);
+            break;
+    }
+
+    if(properties.mirror) {
+        painter->translate(bounds.left() + bounds.right(), 0);
+        painter->scale(-1, 1);
+    }
+
+    const QString suffix = QFileInfo(url.path()).suffix().toLower();
+    const bool photo = suffix == QLatin1String("jpg") || suffix == QLatin1String("jpeg");
+
+    if(tiled) {
+        if(tileSize.isEmpty())
+            return;
+        const QImage tile = applyImagePolicy(painter, image, sourceRect, QRectF(QPointF(0, 0), tileSize));
+
+        // Tiles are anchored so that one of them sits at the aligned position,
+        // a single texture brush fill ends up as one pattern in the PDF
+        const QPointF anchor = alignedPosition(bounds, tileSize, properties.horizontalAlignment, properties.verticalAlignment);
+        QTransform brushTransform;
+        brushTransform.translate(anchor.x(), anchor.y());
+        brushTransform.scale(tileSize.width() / tile.width(), tileSize.height() / tile.height());
+
+        QBrush brush(tile);
+        brush.setTransform(brushTransform);
+        setLosslessImageRendering(painter, !(photo ? imagePolicy.lossyPhotos : imagePolicy.lossyGraphics));
+        painter->fillRect(bounds, brush);
+    } else {
+        drawImage(painter, targetRect, image, sourceRect, photo);
     }
-    painter->drawImage(rect, image, sourceRect);
+}
+
+void QmlPrinter::drawImage(QPainter *painter, const QRectF &targetRect, const QImage &image, const QRectF &sourceRect, bool photo)
+{
+    if(image.isNull())
+        return;
+
+    const QImage prepared = applyImagePolicy(painter, image, sourceRect, targetRect);
+    const qreal scaleX = qreal(prepared.width()) / image.width();
+    const qreal scaleY = qreal(prepared.height()) / image.height();
+    const QRectF preparedSourceRect(sourceRect.x() * scaleX, sourceRect.y() * scaleY,
+                                    sourceRect.width() * scaleX, sourceRect.height() * scaleY);
+
+    setLosslessImageRendering(painter, !(photo ? imagePolicy.lossyPhotos : imagePolicy.lossyGraphics));
+    painter->drawImage(targetRect, prepared, preparedSourceRect);
+}
+
+QImage QmlPrinter::applyImagePolicy(QPainter *painter, const QImage &image, const QRectF &sourceRect, const QRectF &targetRect)
+{
+    ImagePolicy policy = imagePolicy;
+    policy.grayscale = policy.grayscale || colorMode == QPrinter::GrayScale;
+    if(policy.targetDpi <= 0 && !policy.grayscale)
+        return image;
+    if(sourceRect.isEmpty())
+        return image;
+
+    // Size of the whole image on paper in inches, only the part inside
+    // sourceRect ends up covering the target
+    const QRectF deviceRect = painter->worldTransform().mapRect(targetRect);
+    const QPaintDevice *device = painter->device();
+    const QSizeF paperSize(deviceRect.width() / device->logicalDpiX() * image.width() / sourceRect.width(),
+                           deviceRect.height() / device->logicalDpiY() * image.height() / sourceRect.height());
+
+    const QSize size = policy.targetSize(image.size(), paperSize);
+    if(size == image.size() && !policy.grayscale)
+        return image;
+
+    const QImage cached = imageCache.variant(image, size);
+    if(!cached.isNull())
+        return cached;
+    return imageCache.insertVariant(image, size, policy.apply(image, size));
+}
+
+void QmlPrinter::setLosslessImageRendering(QPainter *painter, bool lossless)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    if(painter->testRenderHint(QPainter::LosslessImageRendering) != lossless)
+        painter->setRenderHint(QPainter::LosslessImageRendering, lossless);
+#else
+    Q_UNUSED(painter);
+    Q_UNUSED(lossless);
+#endif
+}
+
+QPointF QmlPrinter::alignedPosition(const QRectF &bounds, const QSizeF &size, int horizontalAlignment, int verticalAlignment)
+{
+    QPointF position = bounds.topLeft();
+    if(horizontalAlignment & Qt::AlignRight)
+        position.rx() += bounds.width() - size.width();
+    else if(horizontalAlignment & Qt::AlignHCenter)
+        position.rx() += (bounds.width() - size.width()) / 2;
+
+    if(verticalAlignment & Qt::AlignBottom)
+        position.ry() += bounds.height() - size.height();
+    else if(verticalAlignment & Qt::AlignVCenter)
+        position.ry() += (bounds.height() - size.height()) / 2;
+    return position;
+}
+
+QImage QmlPrinter::loadImage(const QUrl &url, const QSize &sourceSize)
+{
+    const QImage cached = imageCache.image(url, sourceSize);
+    if(!cached.isNull())
+        return cached;
+
+    const QString fileName = imageFileName(url);
+
+    // Images on disk are keyed by the file content, not by its name
+    QByteArray persistentKey;
+    if(persistentCache.isEnabled()) {
+        QByteArray content = PersistentCache::fileHash(fileName);
+        if(!content.isEmpty()) {
+            QDataStream stream(&content, QIODevice::Append);
+            stream << sourceSize;
+            persistentKey = QCryptographicHash::hash(content, QCryptographicHash::Sha1);
+            const QImage stored = persistentCache.image(persistentKey);
+            if(!stored.isNull())
+                return imageCache.insert(url, sourceSize, stored);
+        }
+    }
+
+    QImageReader reader(fileName);
+    // Only decode what's needed when sourceSize limits the image, formats such
+    // as JPEG can scale down while decoding
+    const QSize size = reader.size();
+    if(size.isValid() && (sourceSize.width() > 0 || sourceSize.height() > 0)) {
+        const QSize bound(sourceSize.width() > 0 ? sourceSize.width() : INT_MAX,
+                          sourceSize.height() > 0 ? sourceSize.height() : INT_MAX);
+        if(size.width() > bound.width() || size.height() > bound.height())
+            reader.setScaledSize(size.scaled(bound, Qt::KeepAspectRatio));
+    }
+
+    QImage image = reader.read();
+    if(image.isNull()) {
+        qWarning() << "QuickItemPainter::loadImage unable to load image: " << url << reader.errorString();
+        return image;
+    }
+    if(!persistentKey.isEmpty())
+        persistentCache.insertImage(persistentKey, image);
+    return imageCache.insert(url, sourceSize, image);
+}
+
+QString QmlPrinter::imageFileName(const QUrl &url) const
+{
+    if(url.scheme() == QLatin1String("qrc"))
+        return QLatin1Char(':') + url.path();
+    return url.toLocalFile();
+}
+
+void QmlPrinter::setColorMode(QPrinter::ColorMode mode)
+{
+    if(colorMode == mode)
+        return;
+    colorMode = mode;
+    // Converted variants of the images no longer match
+    imageCache.clear();
+}
+
+void QmlPrinter::setImagePolicy(const ImagePolicy &policy)
+{
+    imagePolicy = policy;
+    // Variants aren't keyed by the policy, those made under the old one would
+    // be drawn again
+    imageCache.clearVariants();
+}
+
+ImagePolicy QmlPrinter::currentImagePolicy() const
+{
+    return imagePolicy;
+}
+
+void QmlPrinter::setRasterThreshold(int primitives)
+{
+    rasterThreshold = primitives;
+}
+
+void QmlPrinter::setRasterResolution(int dpi)
+{
+    rasterResolution = dpi;
+}
+
+QList<QmlPrinter::RasterDecision> QmlPrinter::lastRasterDecisions() const
+{
+    return rasterDecisions;
+}
+
+void QmlPrinter::setBandHeight(int pixels)
+{
+    bandHeight = qMax(0, pixels);
+}
+
+bool QmlPrinter::setCacheDirectory(const QString &path, qint64 maxSize)
+{
+    persistentCache.setMaxSize(maxSize);
+    return persistentCache.setDirectory(path);
+}
+
+void QmlPrinter::setMemoryBudget(qint64 bytes)
+{
+    memoryBudget = bytes;
+    imageCache.setMaxCost(bytes / 2);
+    textLayoutCache.setMaxCost(bytes / 8);
+    textDocumentCache.setMaxCost(bytes / 16);
+    forms.setMaxCost(maxCacheCost(bytes / 16));
+}
+
+QmlPrinter::PrintStats QmlPrinter::lastPrintStats() const
+{
+    return jobStats;
+}
+
+QByteArray QmlPrinter::saveSettings() const
+{
+    QByteArray settings;
+    QDataStream stream(&settings, QIODevice::WriteOnly);
+    stream << settingsVersion;
+    stream << printableItems << reusableItems;
+    stream << imagePolicy.targetDpi << imagePolicy.lossyPhotos << imagePolicy.lossyGraphics << imagePolicy.grayscale;
+    stream << int(colorMode) << rasterThreshold << rasterResolution << bandHeight << memoryBudget << linearizePDF;
+    stream << persistentCache.directory() << persistentCache.maximumSize();
+    return settings;
+}
+
+bool QmlPrinter::restoreSettings(const QByteArray &settings)
+{
+    QDataStream stream(settings);
+    quint32 version = 0;
+    stream >> version;
+    if(version != settingsVersion)
+        return false;
+
+    QList<QString> printable;
+    QList<QString> reusable;
+    ImagePolicy policy;
+    int mode = 0;
+    int threshold = 0;
+    int resolution = 0;
+    int band = 0;
+    qint64 budget = 0;
+    bool linearized = false;
+    QString cacheDirectory;
+    qint64 cacheSize = 0;
+    stream >> printable >> reusable;
+    stream >> policy.targetDpi >> policy.lossyPhotos >> policy.lossyGraphics >> policy.grayscale;
+    stream >> mode >> threshold >> resolution >> band >> budget >> linearized;
+    stream >> cacheDirectory >> cacheSize;
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    printableItems = printable;
+    reusableItems = reusable;
+    setImagePolicy(policy);
+    setColorMode(QPrinter::ColorMode(mode));
+    setRasterThreshold(threshold);
+    setRasterResolution(resolution);
+    setBandHeight(band);
+    setMemoryBudget(budget);
+    setLinearized(linearized);
+    return setCacheDirectory(cacheDirectory, cacheSize);
 }
 
 bool QmlPrinter::inherits(const QMetaObject *metaObject, const QString &name)
@@ -449,11 +1416,30 @@ bool QmlPrinter::inherits(const QMetaObject *metaObject, const QString &name)
     return false;
 }
 
+void QmlPrinter::setLinearized(bool linearized)
+{
+    linearizePDF = linearized;
+}
+
 void QmlPrinter::addPrintableItem(const QString &item)
 {
     printableItems.push_back(item);
 }
 
+void QmlPrinter::addReusableItem(const QString &item)
+{
+    reusableItems.push_back(item);
+}
+
+bool QmlPrinter::isReusableItem(const QString &item)
+{
+    foreach(const QString &reusableItem, reusableItems) {
+        if(item.contains(reusableItem))
+            return true;
+    }
+    return false;
+}
+
 bool QmlPrinter::isCustomPrintItem(const QString &item)
 {
     QListIterator<QString> it(printableItems);
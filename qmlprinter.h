@@ -11,38 +11,267 @@
 #include <QObject>
 #include <QQuickItem>
 #include <QQuickWindow>
+#include <QImageReader>
+#include <QPageLayout>
 #include <QPainter>
+#include <QPicture>
 #include <QPrinter>
 #include <QPrintDialog>
 #include <QDesktopServices>
+#include <QFileInfo>
+#include <QCache>
+#include <QDataStream>
 #include <QAbstractTextDocumentLayout>
 #include <QTextDocument>
+#include "displaylist.h"
+#include "imagecache.h"
+#include "imagepolicy.h"
+#include "imposition.h"
+#include "itemproperties.h"
+#include "persistentcache.h"
+#include "rectanglebatch.h"
 #include "styledtext.h"
+#include "textdocumentcache.h"
+#include "textlayoutcache.h"
 #include <QPrinterInfo>
+
+// QmlPrinter is reentrant: every instance keeps its caches and job state to
+// itself, so separate instances can print at the same time from different
+// threads. An instance must only be used from one thread at a time and only
+// for items whose window lives in that thread.
 class QmlPrinter : public QObject
 {
     Q_OBJECT
+public:
+    // A subtree which was printed as a single image instead of vectors
+    struct RasterDecision
+    {
+        QString className;
+        QString objectName;
+        int primitives;
+        // Area of the image on the page in device pixels
+        QRectF rect;
+    };
+
+    struct PrintStats
+    {
+        PrintStats() : pages(0), peakMemory(0), peakCacheMemory(0), textLayoutHits(0),
+            textLayoutMisses(0), uniqueImages(0) { }
+
+        int pages;
+        // Peak of the memory held by caches, screen grabs and raster images
+        qint64 peakMemory;
+        qint64 peakCacheMemory;
+        // Text runs drawn from an already shaped layout and ones shaped anew
+        int textLayoutHits;
+        int textLayoutMisses;
+        // Most distinct decoded images held at once, every one of them is a
+        // single image object in a PDF
+        int uniqueImages;
+    };
+
 private:
+    struct PaintState
+    {
+        PaintState() : opacity(1.0), rasterized(false), form(false) { }
+
+        // Maps item coordinates to the device
+        QTransform transform;
+        // Maps scene coordinates to the device, used for screen grabs
+        QTransform scene;
+        qreal opacity;
+        // Set when the subtree is already being painted into a raster image
+        bool rasterized;
+        // Set while a reusable subtree is recorded, dynamic items are left out
+        bool form;
+    };
+
+    struct SubtreeCost
+    {
+        SubtreeCost() : primitives(0), hasText(false) { }
+
+        int primitives;
+        // Text is always kept as vectors
+        bool hasText;
+    };
+
+    // Geometry decided for a page before anything is painted
+    struct PagePlan
+    {
+        QQuickItem *item;
+        QPageLayout::Orientation orientation;
+        // Size of the printable area in device pixels, the page item is
+        // resized to this before painting
+        QSizeF size;
+    };
 
     QList<QString> printableItems;
+    TextLayoutCache textLayoutCache;
+    TextDocumentCache textDocumentCache;
+    ImageCache imageCache;
+    ImagePolicy imagePolicy;
+    RectangleBatch rectangleBatch;
 
-    void paintItem(QQuickItem *item, QQuickWindow *window, QPainter *painter);
+    QScopedPointer<QPrinter> sessionPrinter;
+    QPainter sessionPainter;
+    bool coalesceJobs;
+    PrintStats jobStats;
+
+    // Recorded reusable subtrees keyed by a hash of their structure and content
+    QList<QString> reusableItems;
+    QCache<QByteArray, DisplayList> forms;
+    // Decoded images kept across processes
+    PersistentCache persistentCache;
+
+    // Height of the strips pages are rasterized in for printer drivers,
+    // zero paints vectors
+    int bandHeight;
+
+    int rasterThreshold;
+    int rasterResolution;
+    QHash<QQuickItem*, SubtreeCost> subtreeCosts;
+    QList<RasterDecision> rasterDecisions;
+
+    // Set when the PDF is written to a temporary file and linearized into
+    // pdfLocation once the job ends
+    bool linearizePDF;
+    QString pdfLocation;
+
+    QPrinter::ColorMode colorMode;
+
+    qint64 memoryBudget;
+    QImage pageGrab;
+    QQuickWindow *pageGrabWindow;
+    // Scene graph content of the current page, recorded while synchronizing
+    QHash<QQuickItem*, DisplayList> sceneGraphItems;
+
+    void paintItem(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state);
     void paintQQuickRectangle(QQuickItem *item, QPainter *painter);
     void paintQQuickText(QQuickItem *item, QPainter *painter);
     void paintQQuickImage(QQuickItem *item, QPainter *painter);
-    void paintQQuickCanvasItem(QQuickItem *item, QQuickWindow *window, QPainter *painter);
+    void paintQQuickCanvasItem(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state);
+    // Paints the item from its scene graph nodes when built with qmlprinter_scenegraph
+    bool paintSceneGraphNodes(QQuickItem *item, QPainter *painter);
+    // Brings the scene graph up to date with the page and copies the nodes
+    // of the items painted from them
+    void syncSceneGraph(QQuickItem *page);
+    void recordSceneGraphNodes(QQuickItem *item);
+    bool isSceneGraphItem(QQuickItem *item);
+    bool hasSceneGraphItems(QQuickItem *item);
+
+    bool paintForm(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state);
+    void paintDynamicItems(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state);
+    bool hashSubtree(QQuickItem *item, QQuickItem *parent, QDataStream &stream);
+    bool isDynamicItem(QQuickItem *item) const;
+
+    void paintPage(QQuickItem *page, QPainter *painter);
+    void paintBanded(QQuickItem *page);
+    SubtreeCost estimateCost(QQuickItem *item);
+    void rasterizeItem(QQuickItem *item, QQuickWindow *window, QPainter *painter, const PaintState &state, const SubtreeCost &cost);
+
+    QPointF alignedPosition(const QRectF &bounds, const QSizeF &size, int horizontalAlignment, int verticalAlignment);
+    QString imageFileName(const QUrl &url) const;
+    QImage loadImage(const QUrl &url, const QSize &sourceSize);
+    QImage grabScene(QQuickWindow *window, const QRect &rect);
+    void releasePageGrab();
+    void trackMemory(qint64 transientBytes = 0);
+    void drawImage(QPainter *painter, const QRectF &targetRect, const QImage &image, const QRectF &sourceRect, bool photo);
+    QImage applyImagePolicy(QPainter *painter, const QImage &image, const QRectF &sourceRect, const QRectF &targetRect);
+    void setLosslessImageRendering(QPainter *painter, bool lossless);
+
+    QSharedPointer<QTextLayout> textLayout(QQuickItem *item, const TextLayoutKey &key, const QTextOption &textOption);
+    void drawTextLayout(QPainter *painter, const QTextLayout &layout, const QPointF &position);
+    QString plainText(const TextLayoutKey &key);
+
+    PaintState pagePaintState(QQuickItem *page);
+    PaintState scenePaintState(const PaintState &state);
+    PaintState childPaintState(QQuickItem *child, QQuickItem *parent, const PaintState &parentState);
+    void applyPaintState(QPainter *painter, const PaintState &state);
 
     bool inherits(const QMetaObject *metaObject, const QString &name);
     bool isCustomPrintItem(const QString &item);
+    bool isReusableItem(const QString &item);
 
-    void changePrinterOrientation(QPrinter& printer, const int& width, const int& height);
+    QList<PagePlan> planPages(const QList<QQuickItem*> &items) const;
+    QSizeF printableSize(QPageLayout::Orientation orientation) const;
+    bool beginPage(const PagePlan &page);
 public:
     explicit QmlPrinter(QObject *parent = 0);
     virtual ~QmlPrinter();
 
     bool printPDF(const QString &location, QList<QQuickItem *> items, bool showPDF = false);
     bool print(const QPrinterInfo& info, QList<QQuickItem*> items);
+
+    // Sessions keep the printer open so that many documents can be printed
+    // without setting up the printer for each of them. With coalesce the
+    // documents are sent to the printer as a single spool job.
+    bool beginPDF(const QString &location);
+    bool begin(const QPrinterInfo &info, bool coalesce = true);
+    bool printPages(QList<QQuickItem*> items);
+    bool end();
+    bool isActive() const;
+
+    // Prints the pages scaled onto sheets, each page is painted only once no
+    // matter how many times it's placed. Duplex impositions set up the
+    // printer for it and fail when something else has already been printed
+    // in the session with another duplex mode.
+    bool printImposed(QList<QQuickItem*> items, const Imposition &imposition);
+
+    // Paints the page at its current size into a display list which can be
+    // replayed at any scale without traversing the items again. Images stay
+    // shared with the image cache, so a PDF embeds each of them once however
+    // often the recording is replayed.
+    DisplayList recordPage(QQuickItem *page, DisplayListRecorder::Output output = DisplayListRecorder::VectorOutput);
+
     void addPrintableItem(const QString &item);
+    // Subtrees of these item types are recorded once and replayed wherever an
+    // identical subtree is printed again, for example page headers and
+    // footers. Items inside them with the printDynamic property set to true,
+    // such as page numbers, are painted separately on top every time.
+    // Plain text in them is kept shaped, styled and rich text is shaped again
+    // on every replay. Subtrees containing images are painted normally.
+    void addReusableItem(const QString &item);
+
+    // Keeps decoded images in the directory so that later processes can
+    // start with them, an empty path disables it.
+    // The directory is trimmed to maxSize bytes, oldest entries first.
+    bool setCacheDirectory(const QString &path, qint64 maxSize = 256 * 1024 * 1024);
+
+    // Writes PDFs linearized ("fast web view") so that viewers can show the
+    // first page before the whole file has been downloaded
+    void setLinearized(bool linearized);
+
+    // With GrayScale pen and brush colours are converted by the print engine
+    // as they are written and raster content is converted to 8-bit gray
+    // before it's handed over, whatever the image policy says
+    void setColorMode(QPrinter::ColorMode mode);
+
+    void setImagePolicy(const ImagePolicy &policy);
+    ImagePolicy currentImagePolicy() const;
+
+    // Subtrees without text which would emit at least this many primitives are
+    // printed as a single image at the raster resolution. Zero, the default,
+    // disables it.
+    void setRasterThreshold(int primitives);
+    void setRasterResolution(int dpi);
+    // Subtrees rasterized during the last print job
+    QList<RasterDecision> lastRasterDecisions() const;
+
+    // Rasterizes pages in horizontal bands of at most this many device pixels
+    // when printing to a printer driver instead of a PDF. The bands are
+    // rendered in parallel while earlier ones are sent to the printer. Zero,
+    // the default, prints vectors.
+    void setBandHeight(int pixels);
+
+    // Upper limit for the memory held by caches and screen grabs during a
+    // print job, caches start evicting when they reach their share of it
+    void setMemoryBudget(qint64 bytes);
+    PrintStats lastPrintStats() const;
+
+    // Everything configured through the setters above, for setting up
+    // another printer the same way, for example in a worker process
+    QByteArray saveSettings() const;
+    bool restoreSettings(const QByteArray &settings);
 signals:
 
 public slots:
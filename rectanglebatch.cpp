@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "rectanglebatch.h"
+
+RectangleBatch::RectangleBatch() :
+    antialiasing(false)
+{
+}
+
+bool RectangleBatch::add(QPainter *painter, const QRectF &rect, qreal radius, const QBrush &brush, const QPen &pen)
+{
+    const QTransform &transform = painter->worldTransform();
+    if(transform.type() > QTransform::TxTranslate || painter->opacity() < 1.0)
+        return false;
+    // Gradients are defined in item coordinates and can't be moved to device space
+    if(brush.style() != Qt::SolidPattern)
+        return false;
+    if(!brush.isOpaque() || (pen.style() != Qt::NoPen && pen.color().alpha() != 255))
+        return false;
+
+    const bool antialiasing = painter->testRenderHint(QPainter::Antialiasing);
+    if(!isEmpty() && (brush != this->brush || pen != this->pen || antialiasing != this->antialiasing))
+        flush(painter);
+
+    const QRectF deviceRect = rect.translated(transform.dx(), transform.dy());
+    if(pen.style() != Qt::NoPen) {
+        // Strokes extend half of the pen width outside the rectangle
+        const qreal margin = qMax<qreal>(pen.widthF(), 1.0) / 2;
+        const QRectF area = deviceRect.adjusted(-margin, -margin, margin, margin);
+        if(overlapsBorders(area))
+            flush(painter);
+        borderedAreas.append(area);
+        borderedBounds |= area;
+    }
+
+    this->brush = brush;
+    this->pen = pen;
+    this->antialiasing = antialiasing;
+
+    if(radius > 0) {
+        roundedRects.addRoundedRect(deviceRect, radius, radius);
+    } else {
+        rects.append(deviceRect);
+    }
+    return true;
+}
+
+void RectangleBatch::flush(QPainter *painter)
+{
+    if(isEmpty())
+        return;
+
+    const QTransform transform = painter->worldTransform();
+    const qreal opacity = painter->opacity();
+    const bool painterAntialiasing = painter->testRenderHint(QPainter::Antialiasing);
+
+    painter->setWorldTransform(QTransform());
+    painter->setOpacity(1.0);
+    painter->setRenderHint(QPainter::Antialiasing, antialiasing);
+    painter->setBrush(brush);
+    painter->setPen(pen);
+    if(!rects.isEmpty()) {
+        painter->drawRects(rects.constData(), rects.size());
+        rects.clear();
+    }
+    if(!roundedRects.isEmpty()) {
+        painter->drawPath(roundedRects);
+        roundedRects = QPainterPath();
+    }
+
+    borderedAreas.clear();
+    borderedBounds = QRectF();
+
+    painter->setWorldTransform(transform);
+    painter->setOpacity(opacity);
+    painter->setRenderHint(QPainter::Antialiasing, painterAntialiasing);
+}
+
+bool RectangleBatch::overlapsBorders(const QRectF &deviceRect) const
+{
+    if(!borderedBounds.intersects(deviceRect))
+        return false;
+    foreach(const QRectF &area, borderedAreas) {
+        if(area.intersects(deviceRect))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef RECTANGLEBATCH_H
+#define RECTANGLEBATCH_H
+
+#include <QBrush>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPen>
+#include <QRectF>
+#include <QVector>
+
+// Collects consecutive opaque rectangles sharing the same brush and pen and
+// emits them with a single drawRects / drawPath call. Rectangles are stored in
+// device coordinates so siblings with different positions can share a batch.
+//
+// Note: a batch fills all of its rectangles before stroking them, so only
+// fully opaque rectangles are accepted and a bordered rectangle overlapping
+// one already in the batch starts a new batch to keep the stacking order.
+class RectangleBatch
+{
+public:
+    RectangleBatch();
+
+    // Returns false if the rectangle can't be batched with the current painter
+    // state, in which case the caller has to draw it directly.
+    bool add(QPainter *painter, const QRectF &rect, qreal radius, const QBrush &brush, const QPen &pen);
+
+    // Draws the pending rectangles. The painter transform and opacity are
+    // left as they were.
+    void flush(QPainter *painter);
+
+    bool isEmpty() const { return rects.isEmpty() && roundedRects.isEmpty(); }
+private:
+    // Whether the rectangle would be painted over a border in the batch
+    bool overlapsBorders(const QRectF &deviceRect) const;
+
+    QBrush brush;
+    QPen pen;
+    bool antialiasing;
+    QVector<QRectF> rects;
+    QPainterPath roundedRects;
+    // Device areas covered by the pending rectangles including their borders
+    QVector<QRectF> borderedAreas;
+    QRectF borderedBounds;
+};
+
+#endif // RECTANGLEBATCH_H
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "scenegraphpainter.h"
+
+#include <QSGFlatColorMaterial>
+#include <QSGGeometry>
+#include <QSGTextureMaterial>
+#include <QSGVertexColorMaterial>
+#include <private/qquickitem_p.h>
+#include <private/qsgtexture_p.h>
+
+namespace {
+
+// Vertex of the triangle at position index of the geometry, taking the index
+// array into account
+int vertexIndex(const QSGGeometry *geometry, int index)
+{
+    if(geometry->indexCount() == 0)
+        return index;
+    if(geometry->indexType() == QSGGeometry::UnsignedIntType)
+        return geometry->indexDataAsUInt()[index];
+    return geometry->indexDataAsUShort()[index];
+}
+
+QPointF vertexPosition(const QSGGeometry *geometry, int vertex)
+{
+    // The position is always the first attribute of the vertex
+    const char *data = static_cast<const char*>(geometry->vertexData()) + vertex * geometry->sizeOfVertex();
+    const float *position = reinterpret_cast<const float*>(data);
+    return QPointF(position[0], position[1]);
+}
+
+QColor vertexColor(const QSGGeometry *geometry, int vertex)
+{
+    const QSGGeometry::ColoredPoint2D *points = geometry->vertexDataAsColoredPoint2D();
+    const QSGGeometry::ColoredPoint2D &point = points[vertex];
+    // Vertex colours are premultiplied
+    if(point.a == 0)
+        return QColor(0, 0, 0, 0);
+    return QColor(point.r * 255 / point.a, point.g * 255 / point.a, point.b * 255 / point.a, point.a);
+}
+
+bool hasVertexColors(const QSGGeometry *geometry)
+{
+    return geometry->sizeOfVertex() == int(sizeof(QSGGeometry::ColoredPoint2D))
+            && geometry->attributeCount() == 2
+            && geometry->attributes()[1].type == QSGGeometry::UnsignedByteType;
+}
+
+// Image of a texture if it is still available on the CPU side
+QImage textureImage(QSGMaterial *material)
+{
+    QSGOpaqueTextureMaterial *textureMaterial = dynamic_cast<QSGOpaqueTextureMaterial*>(material);
+    if(!textureMaterial)
+        return QImage();
+    QSGPlainTexture *texture = qobject_cast<QSGPlainTexture*>(textureMaterial->texture());
+    if(!texture)
+        return QImage();
+    return texture->image();
+}
+
+// Triangles of the geometry as vertex index triples
+QVector<int> triangles(const QSGGeometry *geometry)
+{
+    const int count = geometry->indexCount() > 0 ? geometry->indexCount() : geometry->vertexCount();
+    QVector<int> result;
+    switch(geometry->drawingMode()) {
+    case QSGGeometry::DrawTriangles:
+        for(int i = 0; i + 2 < count; i += 3)
+            result << vertexIndex(geometry, i) << vertexIndex(geometry, i + 1) << vertexIndex(geometry, i + 2);
+        break;
+    case QSGGeometry::DrawTriangleStrip:
+        for(int i = 0; i + 2 < count; ++i)
+            result << vertexIndex(geometry, i) << vertexIndex(geometry, i + 1) << vertexIndex(geometry, i + 2);
+        break;
+    case QSGGeometry::DrawTriangleFan:
+        for(int i = 1; i + 1 < count; ++i)
+            result << vertexIndex(geometry, 0) << vertexIndex(geometry, i) << vertexIndex(geometry, i + 1);
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+}
+
+bool SceneGraphPainter::paint(QQuickItem *item, QPainter *painter)
+{
+    QSGNode *node = QQuickItemPrivate::get(item)->paintNode;
+    // The item has not been rendered yet
+    if(!node || !canPaint(node))
+        return false;
+
+    painter->save();
+    painter->setPen(Qt::NoPen);
+    paintNode(node, painter, painter->worldTransform(), painter->opacity());
+    painter->restore();
+    return true;
+}
+
+bool SceneGraphPainter::canPaint(QSGNode *node)
+{
+    switch(node->type()) {
+    case QSGNode::GeometryNodeType: {
+        QSGGeometryNode *geometryNode = static_cast<QSGGeometryNode*>(node);
+        QSGMaterial *material = geometryNode->activeMaterial();
+        if(!material || !geometryNode->geometry())
+            return false;
+        if(dynamic_cast<QSGFlatColorMaterial*>(material) == nullptr
+                && dynamic_cast<QSGVertexColorMaterial*>(material) == nullptr
+                && textureImage(material).isNull())
+            return false;
+    } break;
+    case QSGNode::BasicNodeType:
+    case QSGNode::TransformNodeType:
+    case QSGNode::OpacityNodeType:
+    case QSGNode::ClipNodeType:
+        break;
+    default:
+        return false;
+    }
+
+    for(QSGNode *child = node->firstChild(); child; child = child->nextSibling()) {
+        if(!canPaint(child))
+            return false;
+    }
+    return true;
+}
+
+void SceneGraphPainter::paintNode(QSGNode *node, QPainter *painter, const QTransform &transform, qreal opacity)
+{
+    QTransform childTransform = transform;
+    qreal childOpacity = opacity;
+    bool clipped = false;
+
+    switch(node->type()) {
+    case QSGNode::GeometryNodeType:
+        painter->setWorldTransform(transform);
+        paintGeometryNode(static_cast<QSGGeometryNode*>(node), painter, opacity);
+        break;
+    case QSGNode::TransformNodeType: {
+        childTransform = static_cast<QSGTransformNode*>(node)->matrix().toTransform() * transform;
+    } break;
+    case QSGNode::OpacityNodeType:
+        childOpacity = opacity * static_cast<QSGOpacityNode*>(node)->opacity();
+        break;
+    case QSGNode::ClipNodeType: {
+        QSGClipNode *clipNode = static_cast<QSGClipNode*>(node);
+        painter->save();
+        painter->setWorldTransform(transform);
+        if(clipNode->isRectangular())
+            painter->setClipRect(clipNode->clipRect(), Qt::IntersectClip);
+        else if(clipNode->geometry())
+            painter->setClipPath(geometryPath(clipNode->geometry()), Qt::IntersectClip);
+        clipped = true;
+    } break;
+    default:
+        break;
+    }
+
+    if(!qFuzzyIsNull(childOpacity)) {
+        for(QSGNode *child = node->firstChild(); child; child = child->nextSibling())
+            paintNode(child, painter, childTransform, childOpacity);
+    }
+
+    if(clipped)
+        painter->restore();
+}
+
+void SceneGraphPainter::paintGeometryNode(QSGGeometryNode *node, QPainter *painter, qreal opacity)
+{
+    const QSGGeometry *geometry = node->geometry();
+    QSGMaterial *material = node->activeMaterial();
+
+    if(QSGFlatColorMaterial *flat = dynamic_cast<QSGFlatColorMaterial*>(material)) {
+        // Adjacent triangles of the same colour are merged into one fill
+        painter->setOpacity(opacity);
+        painter->fillPath(geometryPath(geometry), flat->color());
+        return;
+    }
+
+    const QImage image = textureImage(material);
+    if(!image.isNull()) {
+        // Image nodes are quads, map the bounds of the texture coordinates to
+        // the bounds of the vertices
+        if(geometry->sizeOfVertex() != int(sizeof(QSGGeometry::TexturedPoint2D)) || geometry->vertexCount() == 0)
+            return;
+        const QSGGeometry::TexturedPoint2D *points = geometry->vertexDataAsTexturedPoint2D();
+        qreal left = points[0].x, top = points[0].y, right = left, bottom = top;
+        qreal sourceLeft = points[0].tx, sourceTop = points[0].ty, sourceRight = sourceLeft, sourceBottom = sourceTop;
+        for(int i = 1; i < geometry->vertexCount(); ++i) {
+            left = qMin<qreal>(left, points[i].x);
+            top = qMin<qreal>(top, points[i].y);
+            right = qMax<qreal>(right, points[i].x);
+            bottom = qMax<qreal>(bottom, points[i].y);
+            sourceLeft = qMin<qreal>(sourceLeft, points[i].tx);
+            sourceTop = qMin<qreal>(sourceTop, points[i].ty);
+            sourceRight = qMax<qreal>(sourceRight, points[i].tx);
+            sourceBottom = qMax<qreal>(sourceBottom, points[i].ty);
+        }
+        const QRectF target(QPointF(left, top), QPointF(right, bottom));
+        const QRectF source(QPointF(sourceLeft, sourceTop), QPointF(sourceRight, sourceBottom));
+        const QRectF pixels(source.left() * image.width(), source.top() * image.height(),
+                            source.width() * image.width(), source.height() * image.height());
+        painter->setOpacity(opacity);
+        painter->drawImage(target, image, pixels);
+        return;
+    }
+
+    if(!hasVertexColors(geometry))
+        return;
+
+    // Per vertex colours are used for antialiased edges and gradients. Runs of
+    // triangles with a single colour are merged, the rest get a linear
+    // gradient between their two most different vertices.
+    painter->setOpacity(opacity);
+    const QVector<int> indices = triangles(geometry);
+    QPainterPath run;
+    run.setFillRule(Qt::WindingFill);
+    QColor runColor;
+    for(int i = 0; i + 2 < indices.size(); i += 3) {
+        const int v[3] = { indices.at(i), indices.at(i + 1), indices.at(i + 2) };
+        const QColor colors[3] = { vertexColor(geometry, v[0]), vertexColor(geometry, v[1]), vertexColor(geometry, v[2]) };
+        QPolygonF triangle;
+        triangle << vertexPosition(geometry, v[0]) << vertexPosition(geometry, v[1]) << vertexPosition(geometry, v[2]);
+
+        if(colors[0] == colors[1] && colors[1] == colors[2]) {
+            if(colors[0] != runColor && !run.isEmpty()) {
+                painter->fillPath(run, runColor);
+                run = QPainterPath();
+                run.setFillRule(Qt::WindingFill);
+            }
+            runColor = colors[0];
+            run.addPolygon(triangle);
+            continue;
+        }
+
+        if(!run.isEmpty()) {
+            painter->fillPath(run, runColor);
+            run = QPainterPath();
+            run.setFillRule(Qt::WindingFill);
+        }
+
+        int from = 0;
+        int to = 1;
+        int distance = -1;
+        for(int a = 0; a < 3; ++a) {
+            for(int b = a + 1; b < 3; ++b) {
+                const int d = qAbs(colors[a].red() - colors[b].red()) + qAbs(colors[a].green() - colors[b].green())
+                        + qAbs(colors[a].blue() - colors[b].blue()) + qAbs(colors[a].alpha() - colors[b].alpha());
+                if(d > distance) {
+                    distance = d;
+                    from = a;
+                    to = b;
+                }
+            }
+        }
+        QLinearGradient gradient(triangle.at(from), triangle.at(to));
+        gradient.setColorAt(0, colors[from]);
+        gradient.setColorAt(1, colors[to]);
+        QPainterPath path;
+        path.addPolygon(triangle);
+        painter->fillPath(path, gradient);
+    }
+    if(!run.isEmpty())
+        painter->fillPath(run, runColor);
+}
+
+QPainterPath SceneGraphPainter::geometryPath(const QSGGeometry *geometry)
+{
+    QPainterPath path;
+    path.setFillRule(Qt::WindingFill);
+    const QVector<int> indices = triangles(geometry);
+    for(int i = 0; i + 2 < indices.size(); i += 3) {
+        QPolygonF triangle;
+        triangle << vertexPosition(geometry, indices.at(i))
+                 << vertexPosition(geometry, indices.at(i + 1))
+                 << vertexPosition(geometry, indices.at(i + 2));
+        path.addPolygon(triangle);
+    }
+    return path;
+}
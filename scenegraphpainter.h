@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef SCENEGRAPHPAINTER_H
+#define SCENEGRAPHPAINTER_H
+
+#include <QPainter>
+#include <QPainterPath>
+#include <QQuickItem>
+#include <QSGNode>
+
+class QSGGeometryNode;
+
+// Paints the scene graph nodes an item has already built for rendering with
+// QPainter. This covers items which don't have a dedicated painter such as
+// Shapes and third party items without grabbing the window.
+//
+// Geometry with flat or per vertex colour materials and textures which still
+// have their image on the CPU side can be translated. Glyph nodes and any other
+// material make paint() return false so that the caller can fall back to
+// something else.
+//
+// Nodes belong to the render thread and are only consistent with their items
+// while the scene graph synchronizes, paint() must be called from a slot
+// connected directly to QQuickWindow::afterSynchronizing. Painting into a
+// DisplayList there keeps a copy which is safe to replay afterwards.
+//
+// Requires the QtQuick private API, enabled with CONFIG += qmlprinter_scenegraph
+class SceneGraphPainter
+{
+public:
+    // Paints the content of the item itself without its child items. The
+    // painter is expected to be in item coordinates.
+    static bool paint(QQuickItem *item, QPainter *painter);
+private:
+    static bool canPaint(QSGNode *node);
+    static void paintNode(QSGNode *node, QPainter *painter, const QTransform &transform, qreal opacity);
+    static void paintGeometryNode(QSGGeometryNode *node, QPainter *painter, qreal opacity);
+    static QPainterPath geometryPath(const QSGGeometry *geometry);
+};
+
+#endif // SCENEGRAPHPAINTER_H
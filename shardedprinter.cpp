@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "shardedprinter.h"
+#include "pdfmerger.h"
+#include "qmlprinter.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QGuiApplication>
+#include <QProcess>
+#include <QQmlContext>
+#include <QQuickView>
+#include <QSGRendererInterface>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+
+namespace {
+
+const char shardArgument[] = "--qmlprinter-shard";
+
+// Time to wait for the first frame of a worker before printing anyway
+const int firstFrameTimeout = 10000;
+
+}
+
+ShardedPrinter::ShardedPrinter()
+    : shards(QThread::idealThreadCount())
+{
+}
+
+void ShardedPrinter::setShards(int shards)
+{
+    this->shards = qMax(1, shards);
+}
+
+void ShardedPrinter::setArguments(const QStringList &arguments)
+{
+    this->arguments = arguments;
+}
+
+void ShardedPrinter::setPrinterSettings(const QByteArray &settings)
+{
+    printerSettings = settings;
+}
+
+QString ShardedPrinter::errorString() const
+{
+    return error;
+}
+
+bool ShardedPrinter::printPDF(const QString &location, const QUrl &source, int pageCount)
+{
+    error.clear();
+    if(pageCount <= 0) {
+        error = "Nothing to print";
+        return false;
+    }
+
+    QTemporaryDir directory;
+    if(!directory.isValid()) {
+        error = "Unable to create a directory for the partial documents";
+        return false;
+    }
+
+    // Workers don't need a screen of their own
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    if(!environment.contains("QT_QPA_PLATFORM"))
+        environment.insert("QT_QPA_PLATFORM", "offscreen");
+
+    const int count = qMin(qMax(1, shards), pageCount);
+    const int pagesPerShard = (pageCount + count - 1) / count;
+
+    QList<QProcess*> workers;
+    QStringList parts;
+    for(int first = 0; first < pageCount; first += pagesPerShard) {
+        const QString part = directory.filePath(QString("part%1.pdf").arg(parts.size()));
+        QStringList workerArguments = arguments;
+        workerArguments << shardArgument << source.toString() << QString::number(first)
+                        << QString::number(qMin(pagesPerShard, pageCount - first)) << part
+                        << QString::fromLatin1(printerSettings.toBase64());
+
+        QProcess *worker = new QProcess;
+        worker->setProcessEnvironment(environment);
+        worker->setProcessChannelMode(QProcess::ForwardedChannels);
+        worker->start(QCoreApplication::applicationFilePath(), workerArguments);
+        workers << worker;
+        parts << part;
+    }
+
+    foreach(QProcess *worker, workers) {
+        const bool finished = worker->waitForFinished(-1);
+        if(error.isEmpty() && (!finished || worker->exitStatus() != QProcess::NormalExit || worker->exitCode() != 0))
+            error = QString("Worker failed: %1").arg(worker->errorString());
+    }
+    qDeleteAll(workers);
+    if(!error.isEmpty())
+        return false;
+
+    PdfMerger merger;
+    foreach(const QString &part, parts) {
+        merger.addFile(part);
+    }
+    if(!merger.merge(location)) {
+        error = merger.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool ShardedPrinter::isWorker(const QStringList &arguments)
+{
+    return arguments.contains(shardArgument);
+}
+
+int ShardedPrinter::runWorker(const QStringList &arguments)
+{
+    const int index = arguments.indexOf(shardArgument);
+    if(index < 0 || index + 5 >= arguments.size())
+        return 1;
+    const QUrl source(arguments.at(index + 1));
+    const int firstPage = arguments.at(index + 2).toInt();
+    const int pageCount = arguments.at(index + 3).toInt();
+    const QString location = arguments.at(index + 4);
+    const QByteArray settings = QByteArray::fromBase64(arguments.at(index + 5).toLatin1());
+
+    QmlPrinter printer;
+    if(!settings.isEmpty() && !printer.restoreSettings(settings))
+        return 1;
+
+    // The offscreen platform has no OpenGL, the software renderer keeps
+    // textures on the CPU side which suits printing anyway
+    if(QGuiApplication::platformName() == "offscreen" && qEnvironmentVariableIsEmpty("QT_QUICK_BACKEND"))
+        QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+
+    QQuickView view;
+    view.rootContext()->setContextProperty("qmlPrinterFirstPage", firstPage);
+    view.rootContext()->setContextProperty("qmlPrinterPageCount", pageCount);
+    view.setSource(source);
+    if(view.status() != QQuickView::Ready || !view.rootObject())
+        return 1;
+
+    // Screen grabs need the window to have rendered at least once
+    QEventLoop loop;
+    QObject::connect(&view, &QQuickWindow::frameSwapped, &loop, &QEventLoop::quit);
+    QTimer::singleShot(firstFrameTimeout, &loop, &QEventLoop::quit);
+    view.show();
+    loop.exec();
+
+    QList<QQuickItem*> pages;
+    foreach(QQuickItem *item, view.rootObject()->childItems()) {
+        if(item->isVisible())
+            pages << item;
+    }
+
+    return printer.printPDF(location, pages) ? 0 : 1;
+}
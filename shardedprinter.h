@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef SHARDEDPRINTER_H
+#define SHARDEDPRINTER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QUrl>
+
+// Prints very large reports by splitting the pages across worker processes.
+// Each worker is the application itself started with a shard argument, it
+// loads the report into an offscreen window of its own and prints its range
+// of pages to a partial PDF with the printer settings it was given. The parts are merged into the final document
+// once every worker has finished.
+//
+// The report is a QML file whose root item has the pages as its children.
+// Workers set the context properties qmlPrinterFirstPage and
+// qmlPrinterPageCount so the report only needs to create its own range.
+//
+// The application has to hand over to the worker early in main(), after its
+// QML types are registered:
+//
+//     if(ShardedPrinter::isWorker(app.arguments()))
+//         return ShardedPrinter::runWorker(app.arguments());
+class ShardedPrinter
+{
+public:
+    ShardedPrinter();
+
+    // Number of worker processes, defaults to the number of cores
+    void setShards(int shards);
+    // Extra arguments given to every worker
+    void setArguments(const QStringList &arguments);
+    // Workers print with these settings, taken from QmlPrinter::saveSettings()
+    void setPrinterSettings(const QByteArray &settings);
+
+    bool printPDF(const QString &location, const QUrl &source, int pageCount);
+    QString errorString() const;
+
+    static bool isWorker(const QStringList &arguments);
+    static int runWorker(const QStringList &arguments);
+private:
+    int shards;
+    QStringList arguments;
+    QByteArray printerSettings;
+    QString error;
+};
+
+#endif // SHARDEDPRINTER_H
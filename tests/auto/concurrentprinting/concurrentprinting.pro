@@ -0,0 +1,7 @@
+QT += testlib quick qml printsupport widgets concurrent
+CONFIG += testcase c++11
+TARGET = tst_concurrentprinting
+
+include($$PWD/../../../QmlPrinter.pri)
+
+SOURCES +=  tst_concurrentprinting.cpp
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <QFile>
+#include <QQmlComponent>
+#include <QQmlEngine>
+#include <QRegularExpression>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QtTest>
+
+#include "qmlprinter.h"
+
+class tst_ConcurrentPrinting : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void concurrentJobs();
+private:
+    QTemporaryDir directory;
+};
+
+namespace {
+
+const int jobCount = 8;
+const int rounds = 4;
+
+// Pages with rectangles, borders, gradients and text so that every property
+// reader and cache is used by all jobs at once
+const char report[] =
+    "import QtQuick 2.0\n"
+    "Item {\n"
+    "    property int pages: 1\n"
+    "    property int job: 0\n"
+    "    Repeater {\n"
+    "        model: pages\n"
+    "        Rectangle {\n"
+    "            objectName: \"page\"\n"
+    "            width: 595; height: 842\n"
+    "            color: \"white\"\n"
+    "            border.width: 2; border.color: \"black\"\n"
+    "            Rectangle {\n"
+    "                x: 40; y: 40; width: 515; height: 80\n"
+    "                gradient: Gradient {\n"
+    "                    GradientStop { position: 0.0; color: \"lightsteelblue\" }\n"
+    "                    GradientStop { position: 1.0; color: \"steelblue\" }\n"
+    "                }\n"
+    "            }\n"
+    "            Column {\n"
+    "                x: 40; y: 140\n"
+    "                Repeater {\n"
+    "                    model: 20\n"
+    "                    Text { text: \"Job \" + job + \" line \" + index; font.pixelSize: 14 }\n"
+    "                }\n"
+    "            }\n"
+    "            Rectangle { x: 40; y: 760; width: 100; height: 40; radius: 8; color: \"orange\" }\n"
+    "        }\n"
+    "    }\n"
+    "}\n";
+
+// Every job builds its own engine and items in its own thread, the way
+// tenants with separate QML engines print
+int printJob(const QString &fileName, int job, int pages)
+{
+    QQmlEngine engine;
+    QQmlComponent component(&engine);
+    component.setData(report, QUrl());
+    QScopedPointer<QObject> root(component.beginCreate(engine.rootContext()));
+    if(root.isNull())
+        return -1;
+    root->setProperty("job", job);
+    root->setProperty("pages", pages);
+    component.completeCreate();
+
+    QList<QQuickItem*> items;
+    foreach(QQuickItem *child, qobject_cast<QQuickItem*>(root.data())->childItems()) {
+        if(child->objectName() == "page")
+            items << child;
+    }
+
+    QmlPrinter printer;
+    printer.addReusableItem("QQuickColumn");
+    if(!printer.printPDF(fileName, items))
+        return -1;
+    return printer.lastPrintStats().pages;
+}
+
+int pdfPageCount(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return -1;
+    const QByteArray data = file.readAll();
+    if(!data.startsWith("%PDF-") || !data.trimmed().endsWith("%%EOF"))
+        return -1;
+    // "/Type /Pages" is the page tree, not a page
+    return QString::fromLatin1(data).count(QRegularExpression("/Type\\s*/Page\\b"));
+}
+
+}
+
+void tst_ConcurrentPrinting::initTestCase()
+{
+    QVERIFY(directory.isValid());
+}
+
+void tst_ConcurrentPrinting::concurrentJobs()
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobCount);
+
+    for(int round = 0; round < rounds; ++round) {
+        // Jobs print a different number of pages so that mixed up state
+        // between them shows in the output
+        QList<QFuture<int> > futures;
+        QStringList fileNames;
+        for(int job = 0; job < jobCount; ++job) {
+            const QString fileName = directory.filePath(QString("round%1-job%2.pdf").arg(round).arg(job));
+            fileNames << fileName;
+            futures << QtConcurrent::run(&pool, printJob, fileName, job, job + 1);
+        }
+
+        for(int job = 0; job < jobCount; ++job) {
+            QCOMPARE(futures[job].result(), job + 1);
+            QCOMPARE(pdfPageCount(fileNames.at(job)), job + 1);
+        }
+    }
+}
+
+QTEST_MAIN(tst_ConcurrentPrinting)
+
+#include "tst_concurrentprinting.moc"
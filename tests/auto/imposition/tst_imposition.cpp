@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <QFile>
+#include <QImage>
+#include <QQmlComponent>
+#include <QQmlContext>
+#include <QQmlEngine>
+#include <QRegularExpression>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "qmlprinter.h"
+
+class tst_Imposition : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void repeatedImageIsEmbeddedOnce();
+    void duplexAfterPaintingStarted();
+private:
+    QList<QQuickItem*> pages() const;
+
+    QTemporaryDir directory;
+    QQmlEngine engine;
+    QScopedPointer<QObject> root;
+};
+
+namespace {
+
+const int pageCount = 6;
+
+// Every page shows the same logo, the way letterheads do
+const char report[] =
+    "import QtQuick 2.0\n"
+    "Item {\n"
+    "    Repeater {\n"
+    "        model: 6\n"
+    "        Rectangle {\n"
+    "            objectName: \"page\"\n"
+    "            width: 595; height: 842\n"
+    "            color: \"white\"\n"
+    "            Image { x: 40; y: 40; width: 200; height: 100; source: logo }\n"
+    "            Rectangle { x: 40; y: 200; width: 515; height: 400; color: \"lightsteelblue\" }\n"
+    "        }\n"
+    "    }\n"
+    "}\n";
+
+int imageObjects(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return -1;
+    return QString::fromLatin1(file.readAll()).count(QRegularExpression("/Subtype\\s*/Image\\b"));
+}
+
+}
+
+void tst_Imposition::initTestCase()
+{
+    QVERIFY(directory.isValid());
+
+    // Opaque so that the PDF doesn't need a soft mask object for it
+    QImage logo(400, 200, QImage::Format_RGB32);
+    for(int y = 0; y < logo.height(); ++y) {
+        for(int x = 0; x < logo.width(); ++x)
+            logo.setPixel(x, y, qRgb(x * 255 / logo.width(), y * 255 / logo.height(), 128));
+    }
+    const QString logoFile = directory.filePath("logo.png");
+    QVERIFY(logo.save(logoFile));
+
+    engine.rootContext()->setContextProperty("logo", QUrl::fromLocalFile(logoFile));
+    QQmlComponent component(&engine);
+    component.setData(report, QUrl());
+    root.reset(component.create());
+    QVERIFY2(!root.isNull(), qPrintable(component.errorString()));
+    QCOMPARE(pages().size(), pageCount);
+}
+
+QList<QQuickItem*> tst_Imposition::pages() const
+{
+    QList<QQuickItem*> items;
+    foreach(QQuickItem *child, qobject_cast<QQuickItem*>(root.data())->childItems()) {
+        if(child->objectName() == "page")
+            items << child;
+    }
+    return items;
+}
+
+void tst_Imposition::repeatedImageIsEmbeddedOnce()
+{
+    const QString fileName = directory.filePath("imposed.pdf");
+    QmlPrinter printer;
+    QVERIFY(printer.beginPDF(fileName));
+    QVERIFY(printer.printImposed(pages(), Imposition::nUp(2, 1)));
+    QVERIFY(printer.end());
+
+    QCOMPARE(printer.lastPrintStats().pages, pageCount / 2);
+    QCOMPARE(printer.lastPrintStats().uniqueImages, 1);
+    // Replaying the recorded pages draws the very same QImage every time,
+    // which the PDF engine writes as a single image object
+    QCOMPARE(imageObjects(fileName), 1);
+}
+
+void tst_Imposition::duplexAfterPaintingStarted()
+{
+    QmlPrinter printer;
+    QVERIFY(printer.beginPDF(directory.filePath("duplex.pdf")));
+    QVERIFY(printer.printPages(pages().mid(0, 1)));
+    // Switching the printer to duplex in the middle of the job is rejected
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("duplex imposition"));
+    QVERIFY(!printer.printImposed(pages(), Imposition::nUp(2, 1, true)));
+    QVERIFY(printer.end());
+
+    // Before anything is painted the printer is set up for it
+    QVERIFY(printer.beginPDF(directory.filePath("duplex.pdf")));
+    QVERIFY(printer.printImposed(pages(), Imposition::nUp(2, 1, true)));
+    QVERIFY(printer.end());
+}
+
+QTEST_MAIN(tst_Imposition)
+
+#include "tst_imposition.moc"
@@ -0,0 +1,12 @@
+QT += testlib gui
+CONFIG += testcase c++11
+TARGET = tst_pdflinearizer
+
+INCLUDEPATH += $$PWD/../../..
+
+SOURCES +=  tst_pdflinearizer.cpp \
+            $$PWD/../../../pdfdocument.cpp \
+            $$PWD/../../../pdflinearizer.cpp
+
+HEADERS +=  $$PWD/../../../pdfdocument.h \
+            $$PWD/../../../pdflinearizer.h
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <QFile>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "pdflinearizer.h"
+
+class tst_PdfLinearizer : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void linearizationDictionary_data();
+    void linearizationDictionary();
+    void missingInput();
+private:
+    QString writeDocument(int pages);
+
+    QTemporaryDir directory;
+};
+
+namespace {
+
+// Matches the start of an object or cross reference section, Latin-1 keeps
+// string positions equal to byte offsets
+QRegularExpressionMatch matchAt(const QByteArray &data, qint64 offset, const QString &pattern)
+{
+    const QString text = QString::fromLatin1(data);
+    return QRegularExpression(pattern).match(text, int(offset), QRegularExpression::NormalMatch,
+                                             QRegularExpression::AnchoredMatchOption);
+}
+
+}
+
+void tst_PdfLinearizer::initTestCase()
+{
+    QVERIFY(directory.isValid());
+}
+
+QString tst_PdfLinearizer::writeDocument(int pages)
+{
+    const QString fileName = directory.filePath(QString("input%1.pdf").arg(pages));
+    QPdfWriter writer(fileName);
+    QPainter painter(&writer);
+    for(int page = 0; page < pages; ++page) {
+        if(page > 0)
+            writer.newPage();
+        painter.fillRect(QRect(100, 100, 1000, 500 + page * 100), Qt::darkBlue);
+        painter.drawEllipse(QRect(200, 800, 600, 600));
+    }
+    painter.end();
+    return fileName;
+}
+
+void tst_PdfLinearizer::linearizationDictionary_data()
+{
+    QTest::addColumn<int>("pages");
+
+    QTest::newRow("single page") << 1;
+    QTest::newRow("three pages") << 3;
+}
+
+void tst_PdfLinearizer::linearizationDictionary()
+{
+    QFETCH(int, pages);
+
+    const QString output = directory.filePath(QString("linearized%1.pdf").arg(pages));
+    PdfLinearizer linearizer;
+    QVERIFY2(linearizer.linearize(writeDocument(pages), output), qPrintable(linearizer.errorString()));
+
+    QFile file(output);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray data = file.readAll();
+    const QString text = QString::fromLatin1(data);
+
+    // The dictionary has to be within the first 1024 bytes
+    const QRegularExpressionMatch dictionary = QRegularExpression(
+                "(\\d+) 0 obj\\n<< /Linearized 1 /L (\\d+) *\\s/H \\[ (\\d+) *\\s(\\d+) *\\s\\] "
+                "/O (\\d+) /E (\\d+) *\\s/N (\\d+) /T (\\d+)").match(text);
+    QVERIFY(dictionary.hasMatch());
+    QVERIFY(dictionary.capturedStart() < 1024);
+    const int number = dictionary.captured(1).toInt();
+    const qint64 length = dictionary.captured(2).toLongLong();
+    const qint64 hintOffset = dictionary.captured(3).toLongLong();
+    const qint64 hintLength = dictionary.captured(4).toLongLong();
+    const qint64 firstPageEnd = dictionary.captured(6).toLongLong();
+    const int pageCount = dictionary.captured(7).toInt();
+    const qint64 mainXrefEntries = dictionary.captured(8).toLongLong();
+
+    QCOMPARE(length, qint64(data.size()));
+    QCOMPARE(pageCount, pages);
+    QVERIFY(firstPageEnd > hintOffset + hintLength && firstPageEnd <= length);
+
+    // The hint stream directly follows the catalog and ends with its object
+    QVERIFY(matchAt(data, hintOffset, QString("%1 0 obj\\n").arg(number + 2)).hasMatch());
+    QCOMPARE(data.mid(hintOffset + hintLength - 7, 7), QByteArray("endobj\n"));
+
+    // startxref points at the first page cross reference, its /Prev at the
+    // main one at the end of the file
+    const QRegularExpressionMatch startXref = QRegularExpression("startxref\\n(\\d+)\\n%%EOF\\n$").match(text);
+    QVERIFY(startXref.hasMatch());
+    const qint64 firstXref = startXref.captured(1).toLongLong();
+    QVERIFY(matchAt(data, firstXref, "xref\\n").hasMatch());
+    const QRegularExpressionMatch previous = QRegularExpression("/Prev (\\d+)").match(text, int(firstXref));
+    QVERIFY(previous.hasMatch());
+    const qint64 mainXref = previous.captured(1).toLongLong();
+    const QRegularExpressionMatch mainHeader = matchAt(data, mainXref, "xref\\n\\d+ \\d+\\n");
+    QVERIFY(mainHeader.hasMatch());
+
+    // /T is the offset of the white-space before the first main entry
+    QCOMPARE(mainXrefEntries, qint64(mainHeader.capturedEnd() - 1));
+    QCOMPARE(data.at(int(mainXrefEntries)), '\n');
+    QVERIFY(matchAt(data, mainXrefEntries + 1, "\\d{10} \\d{5} [fn]").hasMatch());
+}
+
+void tst_PdfLinearizer::missingInput()
+{
+    PdfLinearizer linearizer;
+    QVERIFY(!linearizer.linearize(directory.filePath("missing.pdf"), directory.filePath("output.pdf")));
+    QVERIFY(!linearizer.errorString().isEmpty());
+}
+
+QTEST_MAIN(tst_PdfLinearizer)
+
+#include "tst_pdflinearizer.moc"
@@ -0,0 +1,15 @@
+QT += testlib gui
+CONFIG += c++11
+TARGET = tst_bench_grayscale
+
+INCLUDEPATH += $$PWD/../../..
+
+SOURCES +=  tst_bench_grayscale.cpp \
+            $$PWD/../../../imagepolicy.cpp
+
+HEADERS +=  $$PWD/../../../imagepolicy.h
+
+# Same switch as QmlPrinter.pri to measure the AVX2 kernels
+qmlprinter_avx2 {
+    QMAKE_CXXFLAGS += -mavx2
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <QImage>
+#include <QtTest>
+
+#include "imagepolicy.h"
+
+// Throughput of the grayscale conversion in megapixels per second is
+// megapixels / (msecs per iteration / 1000), every image is 12 megapixels.
+class tst_bench_Grayscale : public QObject
+{
+    Q_OBJECT
+private slots:
+    void convert_data();
+    void convert();
+    void qtConversion_data();
+    void qtConversion();
+};
+
+namespace {
+
+const int width = 4000;
+const int height = 3000;
+
+// Smooth gradients with some noise, the kernels don't branch on the content
+// but the conversion of the source format depends on it having alpha
+QImage testImage(QImage::Format format)
+{
+    QImage image(width, height, format);
+    quint32 noise = 12345;
+    for(int y = 0; y < height; ++y) {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for(int x = 0; x < width; ++x) {
+            noise = noise * 1103515245 + 12345;
+            const int alpha = format == QImage::Format_RGB32 ? 255 : 128 + (x & 127);
+            line[x] = qPremultiply(qRgba(x * 255 / width, y * 255 / height, (noise >> 16) & 255, alpha));
+        }
+    }
+    return image;
+}
+
+}
+
+void tst_bench_Grayscale::convert_data()
+{
+    QTest::addColumn<QImage>("image");
+
+    QTest::newRow("RGB32 to Grayscale8") << testImage(QImage::Format_RGB32);
+    QTest::newRow("ARGB32 premultiplied") << testImage(QImage::Format_ARGB32_Premultiplied);
+}
+
+void tst_bench_Grayscale::convert()
+{
+    QFETCH(QImage, image);
+
+    ImagePolicy policy;
+    policy.grayscale = true;
+    QImage gray;
+    QBENCHMARK {
+        gray = policy.apply(image, image.size());
+    }
+    QVERIFY(gray.isGrayscale());
+}
+
+void tst_bench_Grayscale::qtConversion_data()
+{
+    QTest::addColumn<QImage>("image");
+
+    QTest::newRow("RGB32 to Grayscale8") << testImage(QImage::Format_RGB32);
+}
+
+void tst_bench_Grayscale::qtConversion()
+{
+    QFETCH(QImage, image);
+
+    // What the vectorised kernels are compared against
+    QImage gray;
+    QBENCHMARK {
+        gray = image.convertToFormat(QImage::Format_Grayscale8);
+    }
+    QVERIFY(gray.isGrayscale());
+}
+
+QTEST_MAIN(tst_bench_Grayscale)
+
+#include "tst_bench_grayscale.moc"
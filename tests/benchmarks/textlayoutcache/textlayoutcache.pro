@@ -0,0 +1,10 @@
+QT += testlib gui
+CONFIG += c++11
+TARGET = tst_bench_textlayoutcache
+
+INCLUDEPATH += $$PWD/../../..
+
+SOURCES +=  tst_bench_textlayoutcache.cpp \
+            $$PWD/../../../textlayoutcache.cpp
+
+HEADERS +=  $$PWD/../../../textlayoutcache.h
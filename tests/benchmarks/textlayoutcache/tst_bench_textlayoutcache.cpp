@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <QImage>
+#include <QPainter>
+#include <QTextLayout>
+#include <QtTest>
+
+#include "textlayoutcache.h"
+
+class tst_bench_TextLayoutCache : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void drawText_data();
+    void drawText();
+private:
+    QList<TextLayoutKey> runs;
+};
+
+namespace {
+
+// Distinct rows and how often each is drawn, like the headers, labels and
+// repeated table rows of a long report
+const int distinctRows = 50;
+const int repeats = 20;
+
+QSharedPointer<QTextLayout> shape(const TextLayoutKey &key)
+{
+    // Same steps QmlPrinter takes for wrapped plain text
+    QSharedPointer<QTextLayout> layout(new QTextLayout(key.text, key.font));
+    layout->setCacheEnabled(true);
+    layout->beginLayout();
+    qreal height = 0;
+    forever {
+        QTextLine line = layout->createLine();
+        if(!line.isValid())
+            break;
+        line.setLineWidth(key.width);
+        line.setPosition(QPointF(0, height));
+        height += line.height();
+    }
+    layout->endLayout();
+    return layout;
+}
+
+}
+
+void tst_bench_TextLayoutCache::initTestCase()
+{
+    QList<QFont> fonts;
+    fonts << QFont("Sans Serif", 10) << QFont("Sans Serif", 10, QFont::Bold)
+          << QFont("Serif", 12) << QFont("Monospace", 9);
+
+    for(int repeat = 0; repeat < repeats; ++repeat) {
+        for(int row = 0; row < distinctRows; ++row) {
+            TextLayoutKey key;
+            key.text = QString("Row %1: quantity %2, unit price %3.%4 EUR, delivered to warehouse %5")
+                    .arg(row).arg(row * 3).arg(row * 7).arg(row % 100, 2, 10, QChar('0')).arg(row % 5);
+            key.font = fonts.at(row % fonts.size());
+            key.color = Qt::black;
+            key.width = 400;
+            key.textFormat = Qt::PlainText;
+            key.wrapMode = QTextOption::WordWrap;
+            key.alignment = Qt::AlignLeft;
+            key.elide = 0;
+            runs << key;
+        }
+    }
+}
+
+void tst_bench_TextLayoutCache::drawText_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("shaped every time") << false;
+    QTest::newRow("shaped once per job") << true;
+}
+
+void tst_bench_TextLayoutCache::drawText()
+{
+    QFETCH(bool, cached);
+
+    QImage image(600, 200, QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    painter.setPen(Qt::black);
+
+    int hits = 0;
+    QBENCHMARK {
+        // A fresh cache for every iteration, as every print job starts with one
+        TextLayoutCache cache;
+        foreach(const TextLayoutKey &key, runs) {
+            QSharedPointer<QTextLayout> layout;
+            if(cached)
+                layout = cache.layout(key);
+            if(layout.isNull()) {
+                layout = shape(key);
+                if(cached)
+                    cache.insert(key, layout);
+            }
+            layout->draw(&painter, QPointF(0, 0));
+        }
+        hits = cache.hits();
+    }
+    if(cached)
+        QCOMPARE(hits, distinctRows * (repeats - 1));
+}
+
+QTEST_MAIN(tst_bench_TextLayoutCache)
+
+#include "tst_bench_textlayoutcache.moc"
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "textdocumentcache.h"
+#include "cachecost.h"
+
+#include <QAbstractTextDocumentLayout>
+
+TextDocumentCache::TextDocumentCache(qint64 maxCost) :
+    scratch(nullptr)
+{
+    setMaxCost(maxCost);
+}
+
+TextDocumentCache::~TextDocumentCache()
+{
+    delete scratch;
+}
+
+void TextDocumentCache::setMaxCost(qint64 bytes)
+{
+    documents.setMaxCost(maxCacheCost(bytes));
+}
+
+qint64 TextDocumentCache::cost() const
+{
+    return cacheCostBytes(documents.totalCost());
+}
+
+qint64 TextDocumentCache::documentBytes(const QString &html)
+{
+    // Blocks, fragments, formats and the layout of every line scale with the
+    // markup, plus the fixed overhead of the document itself
+    return qint64(html.size()) * 64 + 4096;
+}
+
+QTextDocument *TextDocumentCache::document(const TextLayoutKey &key, const QTextOption &textOption)
+{
+    QTextDocument *document = documents.object(key);
+    if(document)
+        return document;
+
+    // Only documents which are used more than once are worth keeping, the rest
+    // share the scratch document
+    if(seen.contains(key)) {
+        seen.remove(key);
+        document = new QTextDocument;
+        setup(document, key, textOption);
+        // Documents larger than the whole cache are deleted right away
+        if(documents.insert(key, document, cacheCost(documentBytes(key.text))))
+            return document;
+    }
+
+    if(!scratch)
+        scratch = new QTextDocument;
+    // Forget the keys seen once every now and then so that long running
+    // sessions with unique documents don't grow without bounds
+    if(seen.size() >= 1024)
+        seen.clear();
+    seen.insert(key);
+
+    setup(scratch, key, textOption);
+    return scratch;
+}
+
+void TextDocumentCache::clear()
+{
+    documents.clear();
+    seen.clear();
+    delete scratch;
+    scratch = nullptr;
+}
+
+void TextDocumentCache::setup(QTextDocument *document, const TextLayoutKey &key, const QTextOption &textOption)
+{
+    document->clear();
+    document->setTextWidth(key.width);
+    document->setDefaultTextOption(textOption);
+    document->setDefaultFont(key.font);
+    document->setHtml(key.text);
+    // Lay the document out now so that later draws reuse it
+    document->documentLayout()->documentSize();
+}
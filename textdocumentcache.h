@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef TEXTDOCUMENTCACHE_H
+#define TEXTDOCUMENTCACHE_H
+
+#include <QCache>
+#include <QSet>
+#include <QTextDocument>
+#include <QTextOption>
+#include "textlayoutcache.h"
+
+// Laid out QTextDocuments for Qt::RichText items. Documents are kept once the
+// same HTML, font, width and options have been seen twice so that identical
+// items and repeated prints skip both setHtml and the document layout.
+// Documents which are only used once are built into a single recycled
+// document instead of allocating new ones. The least recently used documents
+// are evicted once the cache grows past its maximum cost.
+class TextDocumentCache
+{
+public:
+    explicit TextDocumentCache(qint64 maxCost = 16 * 1024 * 1024);
+    ~TextDocumentCache();
+
+    // Approximate memory used by the cached documents in bytes
+    void setMaxCost(qint64 bytes);
+    qint64 cost() const;
+
+    // The returned document is owned by the cache and stays valid until the
+    // next call or clear()
+    QTextDocument *document(const TextLayoutKey &key, const QTextOption &textOption);
+
+    int documentCount() const { return documents.count(); }
+
+    void clear();
+private:
+    Q_DISABLE_COPY(TextDocumentCache)
+
+    static qint64 documentBytes(const QString &html);
+    static void setup(QTextDocument *document, const TextLayoutKey &key, const QTextOption &textOption);
+
+    QCache<TextLayoutKey, QTextDocument> documents;
+    QSet<TextLayoutKey> seen;
+    QTextDocument *scratch;
+};
+
+#endif // TEXTDOCUMENTCACHE_H
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "textlayoutcache.h"
+#include "cachecost.h"
+
+bool TextLayoutKey::operator==(const TextLayoutKey &other) const
+{
+    return width == other.width
+            && textFormat == other.textFormat
+            && wrapMode == other.wrapMode
+            && alignment == other.alignment
+            && elide == other.elide
+            && color == other.color
+            && font == other.font
+            && text == other.text;
+}
+
+uint qHash(const TextLayoutKey &key, uint seed)
+{
+    seed ^= qHash(key.text, seed);
+    seed ^= qHash(key.font, seed);
+    seed ^= qHash(key.color.rgba(), seed);
+    seed ^= qHash(qRound(key.width * 64), seed);
+    seed ^= qHash((key.textFormat << 24) | (key.wrapMode << 16) | (key.elide << 12) | key.alignment, seed);
+    return seed;
+}
+
+TextLayoutCache::TextLayoutCache(qint64 maxCost) :
+    cacheHits(0),
+    cacheMisses(0)
+{
+    setMaxCost(maxCost);
+}
+
+void TextLayoutCache::setMaxCost(qint64 bytes)
+{
+    layouts.setMaxCost(maxCacheCost(bytes));
+}
+
+qint64 TextLayoutCache::cost() const
+{
+    return cacheCostBytes(layouts.totalCost());
+}
+
+qint64 TextLayoutCache::layoutBytes(const QString &text)
+{
+    // Glyph indices, advances, offsets and attributes for every character
+    // plus the fixed overhead of the layout itself
+    return qint64(text.size()) * 48 + 1024;
+}
+
+const QFontMetricsF &TextLayoutCache::fontMetrics(const QFont &font)
+{
+    QHash<QFont, QFontMetricsF>::iterator it = metrics.find(font);
+    if(it == metrics.end()) {
+        it = metrics.insert(font, QFontMetricsF(font));
+    }
+    return it.value();
+}
+
+QSharedPointer<QTextLayout> TextLayoutCache::layout(const TextLayoutKey &key) const
+{
+    QSharedPointer<QTextLayout> *cached = layouts.object(key);
+    if(!cached) {
+        ++cacheMisses;
+        return QSharedPointer<QTextLayout>();
+    }
+    ++cacheHits;
+    return *cached;
+}
+
+void TextLayoutCache::insert(const TextLayoutKey &key, QSharedPointer<QTextLayout> layout)
+{
+    layouts.insert(key, new QSharedPointer<QTextLayout>(layout), cacheCost(layoutBytes(key.text)));
+}
+
+void TextLayoutCache::clear()
+{
+    metrics.clear();
+    layouts.clear();
+    cacheHits = 0;
+    cacheMisses = 0;
+}
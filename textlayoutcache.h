@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014 Taneli Peltoniemi <taneli.peltoniemi@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef TEXTLAYOUTCACHE_H
+#define TEXTLAYOUTCACHE_H
+
+#include <QCache>
+#include <QColor>
+#include <QFont>
+#include <QFontMetricsF>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QTextLayout>
+
+// Identifies a shaped and laid out text run. Two Text items which produce
+// the same key can share the same QTextLayout.
+struct TextLayoutKey
+{
+    QString text;
+    QFont font;
+    QColor color;
+    qreal width;
+    int textFormat;
+    int wrapMode;
+    int alignment;
+    int elide;
+
+    bool operator==(const TextLayoutKey &other) const;
+};
+
+uint qHash(const TextLayoutKey &key, uint seed = 0);
+
+// Print job scoped cache for font metrics and laid out text. QTextLayout keeps
+// the shaped glyph runs internally so drawing a cached layout again skips
+// both the StyledText parsing and the shaping. Layouts are evicted once the
+// cache grows past its maximum cost.
+class TextLayoutCache
+{
+public:
+    explicit TextLayoutCache(qint64 maxCost = 64 * 1024 * 1024);
+
+    // Approximate memory used by the cached layouts in bytes
+    void setMaxCost(qint64 bytes);
+    qint64 cost() const;
+
+    const QFontMetricsF &fontMetrics(const QFont &font);
+
+    QSharedPointer<QTextLayout> layout(const TextLayoutKey &key) const;
+    void insert(const TextLayoutKey &key, QSharedPointer<QTextLayout> layout);
+
+    int hits() const { return cacheHits; }
+    int misses() const { return cacheMisses; }
+
+    void clear();
+private:
+    static qint64 layoutBytes(const QString &text);
+
+    QHash<QFont, QFontMetricsF> metrics;
+    QCache<TextLayoutKey, QSharedPointer<QTextLayout> > layouts;
+
+    mutable int cacheHits;
+    mutable int cacheMisses;
+};
+
+#endif // TEXTLAYOUTCACHE_H